@@ -0,0 +1,115 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "order_book.h"
+
+// Decides, in the ingest threads and before an order is queued for matching, whether it may go on.
+// Every check is a few atomic operations on fixed tables, there is no lock and no allocation.
+//
+// * Per user rate limit. One token bucket per user, USER_ORDER_BURST tokens refilled at
+//   USER_ORDER_RATE per second, and every order or cancel takes a token. Users are hashed into
+//   USER_BUCKETS slots, two users in one slot share a bucket.
+// * Per symbol in-flight cap. At most SYMBOL_MAX_IN_FLIGHT new orders per symbol may be queued but
+//   not yet matched, so one hot symbol can't fill the pipeline. Symbols are hashed into SYMBOL_SLOTS
+//   slots the same way.
+// * Overload shedding. Once the queue an order would join holds INGEST_SHED_THRESHOLD orders, new
+//   orders are turned away while cancels still get through: they only ever shrink the books.
+//
+// FLUSH is never rejected.
+class AdmissionControl {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::uint32_t noSlot = static_cast<std::uint32_t>(-1);
+
+  AdmissionControl()
+      : buckets_(std::make_unique<std::array<std::atomic<std::int64_t>, USER_BUCKETS>>()),
+        inFlight_(std::make_unique<std::array<std::atomic<std::uint32_t>, SYMBOL_SLOTS>>()) {}
+
+  AdmissionControl(const AdmissionControl&) = delete;
+  void operator=(const AdmissionControl&)   = delete;
+
+  // Called by the ingest threads. Returns why the order is rejected, or nothing if it is admitted.
+  // An admitted new order holds a place in its symbol's in-flight count, symbolSlot is set to where
+  // it has to be released.
+  std::optional<Event::RejectReason> Admit(const Order& order, Clock::time_point now,
+                                           bool saturated, std::uint32_t& symbolSlot) {
+    symbolSlot = noSlot;
+    const auto isNewOrder =
+        (order.orderType == Order::OrderType::BUY || order.orderType == Order::OrderType::SELL);
+    if (order.orderType == Order::OrderType::FLUSH) {
+      return std::nullopt;
+    }
+    if (saturated && isNewOrder) {
+      return Event::RejectReason::OVERLOAD;
+    }
+    if (!TakeToken(order.userId, now)) {
+      return Event::RejectReason::RATE_LIMIT;
+    }
+    if (isNewOrder) {
+      const auto slot = static_cast<std::uint32_t>(std::hash<std::string_view>{}(order.symbol) &
+                                                   (SYMBOL_SLOTS - 1));
+      auto& inFlight  = (*inFlight_)[slot];
+      if (inFlight.fetch_add(1, std::memory_order_relaxed) >= SYMBOL_MAX_IN_FLIGHT) {
+        inFlight.fetch_sub(1, std::memory_order_relaxed);
+        return Event::RejectReason::SYMBOL_IN_FLIGHT;
+      }
+      symbolSlot = slot;
+    }
+    return std::nullopt;
+  }
+
+  // Called by the matching thread once an admitted order has been handled.
+  void Release(std::uint32_t symbolSlot) {
+    if (symbolSlot != noSlot) {
+      (*inFlight_)[symbolSlot].fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  static constexpr std::int64_t interval_ =
+      static_cast<std::int64_t>(std::nano::den / USER_ORDER_RATE);  // Nanoseconds per token.
+  static constexpr std::int64_t tolerance_ = interval_ * (USER_ORDER_BURST - 1);
+
+  // A token bucket kept as the time at which it would next be full (the "theoretical arrival
+  // time" of GCRA), so that taking a token is one compare and swap of a single word. The bucket
+  // has a token if that time is less than a full bucket's worth of refill ahead of now.
+  bool TakeToken(UserId_type userId, Clock::time_point now) {
+    auto& bucket        = (*buckets_)[static_cast<std::uint32_t>(userId) & (USER_BUCKETS - 1)];
+    const auto nowNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              now.time_since_epoch())
+                              .count();
+    auto full = bucket.load(std::memory_order_relaxed);
+    while (true) {
+      const auto start = std::max(full, nowNanos);
+      if (start - nowNanos > tolerance_) {
+        return false;
+      }
+      if (bucket.compare_exchange_weak(full, start + interval_, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+
+  std::unique_ptr<std::array<std::atomic<std::int64_t>, USER_BUCKETS>> buckets_;
+  std::unique_ptr<std::array<std::atomic<std::uint32_t>, SYMBOL_SLOTS>> inFlight_;
+};
+
+#endif  // #ifndef ADMISSION_CONTROL_H
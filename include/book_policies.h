@@ -0,0 +1,497 @@
+#ifndef BOOK_POLICIES_H
+#define BOOK_POLICIES_H
+
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "memory_stats.h"
+#include "types.h"
+
+/////////////////
+/// Price and quantity representations
+/////////////////
+
+// 64-bit fixed-point number with Scale units per whole tick.
+template <std::int64_t Scale>
+struct FixedPoint64 {
+  std::int64_t raw = 0;
+
+  auto operator<=>(const FixedPoint64&) const = default;
+
+  FixedPoint64 operator+(FixedPoint64 other) const { return {raw + other.raw}; }
+  FixedPoint64 operator-(FixedPoint64 other) const { return {raw - other.raw}; }
+  FixedPoint64& operator+=(FixedPoint64 other) {
+    raw += other.raw;
+    return *this;
+  }
+  FixedPoint64& operator-=(FixedPoint64 other) {
+    raw -= other.raw;
+    return *this;
+  }
+};
+
+namespace std {
+template <std::int64_t Scale>
+struct hash<FixedPoint64<Scale>> {
+  std::size_t operator()(FixedPoint64<Scale> value) const noexcept {
+    return std::hash<std::int64_t>{}(value.raw);
+  }
+};
+}  // namespace std
+
+// Converts between the integer prices and quantities on the wire and a book's representation.
+template <typename T>
+struct WireTraits {
+  static_assert(std::is_integral_v<T>, "Unsupported price/quantity type");
+  static T FromWire(std::int64_t value) { return static_cast<T>(value); }
+  static std::int64_t ToWire(T value) { return static_cast<std::int64_t>(value); }
+};
+
+template <std::int64_t Scale>
+struct WireTraits<FixedPoint64<Scale>> {
+  static FixedPoint64<Scale> FromWire(std::int64_t value) { return {value * Scale}; }
+  static std::int64_t ToWire(FixedPoint64<Scale> value) { return value.raw / Scale; }
+};
+
+/////////////////
+/// Allocators
+/////////////////
+
+// Free list of fixed size nodes carved out of large blocks. Node based containers (list, map) only
+// ever allocate one node at a time, which is served from the pool; anything else goes to operator
+// new. Books are only touched by the matching thread, so the pool is not thread safe. The blocks
+// are deliberately never returned, books may be destroyed during static destruction.
+template <std::size_t NodeSize, std::size_t NodeAlign>
+class NodePool {
+public:
+  static NodePool& GetNodePool() {
+    static auto* nodePool = new NodePool();
+    return *nodePool;
+  }
+
+  void* Allocate() {
+    if (freeList_ == nullptr) {
+      Grow();
+    }
+    auto* node = freeList_;
+    freeList_  = freeList_->next;
+    return node;
+  }
+
+  void Deallocate(void* ptr) {
+    auto* node = static_cast<FreeNode*>(ptr);
+    node->next = freeList_;
+    freeList_  = node;
+  }
+
+private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  static constexpr std::size_t nodeSize_ =
+      (std::max(NodeSize, sizeof(FreeNode)) + NodeAlign - 1) / NodeAlign * NodeAlign;
+  static constexpr std::size_t nodesPerBlock_ = 4096;
+
+  void Grow() {
+    auto* block = static_cast<char*>(::operator new(nodeSize_ * nodesPerBlock_,
+                                                    std::align_val_t(std::max(NodeAlign,
+                                                                              alignof(FreeNode)))));
+    for (std::size_t i = nodesPerBlock_; i-- > 0;) {
+      Deallocate(block + i * nodeSize_);
+    }
+  }
+
+  FreeNode* freeList_ = nullptr;
+};
+
+template <typename T>
+struct PoolAllocator {
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(std::size_t n) {
+    if (n == 1) {
+      return static_cast<T*>(NodePool<sizeof(T), alignof(T)>::GetNodePool().Allocate());
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* ptr, std::size_t n) {
+    if (n == 1) {
+      NodePool<sizeof(T), alignof(T)>::GetNodePool().Deallocate(ptr);
+      return;
+    }
+    std::allocator<T>().deallocate(ptr, n);
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>&) const {
+    return true;
+  }
+};
+
+/////////////////
+/// Level containers
+/////////////////
+
+// A level container holds the Limits of one side of a book, keyed by price, and keeps track of the
+// best non-empty level (the top of book). Every container provides:
+//   Limit* Find(Price)          Level at that price, or nullptr.
+//   Limit& FindOrInsert(Price)  Level at that price, created empty if needed. Limits never move.
+//   Limit* Best()               Best level with quantity, or nullptr. O(1).
+//   void Improve(Limit&)        Called once a level gets quantity, it may be the new best.
+//   void AdvanceBest()          Called once the best level is empty, moves to the next best and
+//                               drops the empty levels it passes.
+//   void Erase(Limit&)          Called once a level other than the best is empty, drops it.
+//   std::size_t Size()          Number of levels, empty ones included.
+//   std::size_t SizeIfInserted(Price)
+//                               What Size() would be after FindOrInsert(Price).
+//   bool Fits(Price)            Whether FindOrInsert(Price) can take that price.
+//   std::size_t Bytes()         Estimated heap bytes of the levels, without their orders.
+// Everything better than Best() is empty, which is what lets AdvanceBest() scan from Best() on.
+// Only empty levels are dropped, so the Limits that orders point to never move.
+
+template <Side S>
+using Better_type = std::conditional_t<S == Side::BUY, std::greater<>, std::less<>>;
+
+// Red-black tree (the original design), plus a hash map so that repeat visits to a price are O(1).
+template <typename Limit, Side S, template <typename> class Allocator_T>
+class TreeLevels {
+  using Price    = decltype(Limit::price);
+  using Quantity = decltype(Limit::totalQuantity);
+  using Map_type =
+      std::map<Price, Limit, Better_type<S>, Allocator_T<std::pair<const Price, Limit>>>;
+  using Index_type =
+      std::unordered_map<Price, typename Map_type::iterator, std::hash<Price>, std::equal_to<Price>,
+                         Allocator_T<std::pair<const Price, typename Map_type::iterator>>>;
+
+public:
+  TreeLevels() = default;
+  // best_ is an iterator into levels_, which a move would leave pointing at the wrong end().
+  TreeLevels(const TreeLevels&)     = delete;
+  void operator=(const TreeLevels&) = delete;
+
+  Limit* Find(Price price) {
+    auto it = index_.find(price);
+    return (it == index_.end()) ? nullptr : &it->second->second;
+  }
+
+  Limit& FindOrInsert(Price price) {
+    auto it = index_.find(price);
+    if (it != index_.end()) {
+      return it->second->second;
+    }
+    auto [levelIt, _]     = levels_.try_emplace(price);
+    levelIt->second.price = price;
+    index_.emplace(price, levelIt);
+    return levelIt->second;
+  }
+
+  Limit* Best() { return (best_ == levels_.end()) ? nullptr : &best_->second; }
+
+  void Improve(Limit& limit) {
+    if (best_ == levels_.end() || Better_type<S>{}(limit.price, best_->first)) {
+      best_ = index_.at(limit.price);
+    }
+  }
+
+  void AdvanceBest() {
+    while (best_ != levels_.end() && best_->second.totalQuantity == Quantity{}) {
+      index_.erase(best_->first);
+      best_ = levels_.erase(best_);
+    }
+  }
+
+  void Erase(Limit& limit) {
+    auto it = index_.find(limit.price);
+    levels_.erase(it->second);
+    index_.erase(it);
+  }
+
+  std::size_t Size() const { return levels_.size(); }
+
+  std::size_t SizeIfInserted(Price price) const {
+    return levels_.size() + (index_.contains(price) ? 0 : 1);
+  }
+
+  bool Fits(Price) const { return true; }
+
+  std::size_t Bytes() const { return TreeMapBytes(levels_) + HashMapBytes(index_); }
+
+private:
+  Map_type levels_;
+  Index_type index_;
+  typename Map_type::iterator best_ = levels_.end();
+};
+
+// Sorted flat arrays, worst price first, so the levels that come and go around the top of book sit
+// at the end of the arrays where inserting is cheap. Binary search runs over a contiguous array of
+// prices only.
+template <typename Limit, Side S, template <typename> class Allocator_T>
+class FlatLevels {
+  using Price      = decltype(Limit::price);
+  using Quantity   = decltype(Limit::totalQuantity);
+  using Worse_type = std::conditional_t<S == Side::BUY, std::less<>, std::greater<>>;
+
+public:
+  Limit* Find(Price price) {
+    const auto it = std::lower_bound(prices_.begin(), prices_.end(), price, Worse_type{});
+    return (it != prices_.end() && *it == price) ? limits_[it - prices_.begin()] : nullptr;
+  }
+
+  Limit& FindOrInsert(Price price) {
+    const auto it    = std::lower_bound(prices_.begin(), prices_.end(), price, Worse_type{});
+    const auto index = static_cast<std::size_t>(it - prices_.begin());
+    if (it != prices_.end() && *it == price) {
+      return *limits_[index];
+    }
+    // Inserting above the best level pushes it one further from the end.
+    if (bestRank_ != npos_ && index > prices_.size() - 1 - bestRank_) {
+      ++bestRank_;
+    }
+    Limit* limit = nullptr;
+    if (free_.empty()) {
+      limit = &storage_.emplace_back();
+    } else {
+      limit = free_.back();
+      free_.pop_back();
+    }
+    limit->price = price;
+    prices_.insert(it, price);
+    limits_.insert(limits_.begin() + index, limit);
+    return *limit;
+  }
+
+  Limit* Best() { return (bestRank_ == npos_) ? nullptr : limits_[limits_.size() - 1 - bestRank_]; }
+
+  void Improve(Limit& limit) {
+    if (bestRank_ == npos_ || Better_type<S>{}(limit.price, Best()->price)) {
+      const auto it = std::lower_bound(prices_.begin(), prices_.end(), limit.price, Worse_type{});
+      bestRank_     = prices_.end() - it - 1;
+    }
+  }
+
+  void AdvanceBest() {
+    // Erasing the best level leaves the next worse one at the same distance from the end.
+    while (bestRank_ < limits_.size()) {
+      const auto index = limits_.size() - 1 - bestRank_;
+      if (limits_[index]->totalQuantity != Quantity{}) {
+        return;
+      }
+      EraseAt(index);
+    }
+    bestRank_ = npos_;
+  }
+
+  void Erase(Limit& limit) {
+    const auto it    = std::lower_bound(prices_.begin(), prices_.end(), limit.price, Worse_type{});
+    const auto index = static_cast<std::size_t>(it - prices_.begin());
+    // Erasing above the best level brings it one closer to the end.
+    if (bestRank_ != npos_ && index > limits_.size() - 1 - bestRank_) {
+      --bestRank_;
+    }
+    EraseAt(index);
+  }
+
+  std::size_t Size() const { return limits_.size(); }
+
+  std::size_t SizeIfInserted(Price price) const {
+    const auto it = std::lower_bound(prices_.begin(), prices_.end(), price, Worse_type{});
+    return limits_.size() + ((it != prices_.end() && *it == price) ? 0 : 1);
+  }
+
+  bool Fits(Price) const { return true; }
+
+  std::size_t Bytes() const {
+    return VectorBytes(prices_) + VectorBytes(limits_) + VectorBytes(free_) +
+           storage_.size() * sizeof(Limit);
+  }
+
+private:
+  static constexpr std::size_t npos_ = static_cast<std::size_t>(-1);
+
+  // The Limit stays in storage_, for the next new level.
+  void EraseAt(std::size_t index) {
+    free_.push_back(limits_[index]);
+    prices_.erase(prices_.begin() + index);
+    limits_.erase(limits_.begin() + index);
+  }
+
+  std::vector<Price, Allocator_T<Price>> prices_;
+  std::vector<Limit*, Allocator_T<Limit*>> limits_;
+  std::deque<Limit, Allocator_T<Limit>> storage_;  // Stable addresses for the Limits.
+  std::vector<Limit*, Allocator_T<Limit*>> free_;   // Limits in storage_ of erased levels.
+  std::size_t bestRank_ = npos_;                    // Distance of the best level from the end.
+};
+
+// Dense ladder with one Limit per tick between the lowest and highest price seen, so a price lookup
+// is an array index and the next best level is usually the neighbouring one. Suited to liquid
+// symbols trading in a narrow band, a price too far from the rest of the ladder does not Fit().
+template <typename Limit, Side S, template <typename> class Allocator_T>
+class LadderLevels {
+  using Price    = decltype(Limit::price);
+  using Quantity = decltype(Limit::totalQuantity);
+  using Traits   = WireTraits<Price>;
+
+public:
+  static constexpr std::int64_t maxLevels = 1 << 20;
+
+  Limit* Find(Price price) {
+    const auto index = Traits::ToWire(price) - low_;
+    return (index < 0 || index >= Span()) ? nullptr : &levels_[index];
+  }
+
+  Limit& FindOrInsert(Price price) {
+    const auto ticks = Traits::ToWire(price);
+    if (levels_.empty()) {
+      low_ = ticks;
+    }
+    const auto newLow  = std::min(low_, ticks);
+    const auto newHigh = std::max(low_ + Span() - 1, ticks);
+    if (newHigh - newLow + 1 > maxLevels) {
+      throw std::runtime_error("Price outside of the LadderLevels range.");
+    }
+    // std::deque keeps references valid when growing at either end.
+    for (; low_ > newLow; --low_) {
+      levels_.emplace_front().price = Traits::FromWire(low_ - 1);
+      if (best_ != npos_) {
+        ++best_;
+      }
+    }
+    while (low_ + Span() - 1 < newHigh) {
+      levels_.emplace_back().price = Traits::FromWire(low_ + Span());
+    }
+    return levels_[ticks - low_];
+  }
+
+  Limit* Best() { return (best_ == npos_) ? nullptr : &levels_[best_]; }
+
+  void Improve(Limit& limit) {
+    const auto index = Traits::ToWire(limit.price) - low_;
+    if (best_ == npos_ || Better_type<S>{}(index, best_)) {
+      best_ = index;
+    }
+  }
+
+  void AdvanceBest() {
+    static constexpr std::int64_t step = (S == Side::BUY) ? -1 : 1;
+    while (best_ >= 0 && best_ < Span() && levels_[best_].totalQuantity == Quantity{}) {
+      best_ += step;
+    }
+    if (best_ < 0 || best_ >= Span()) {
+      best_ = npos_;
+    }
+    Trim();
+  }
+
+  // The ladder is dense, so only a level at either end can go.
+  void Erase(Limit&) { Trim(); }
+
+  std::size_t Size() const { return levels_.size(); }
+
+  // Every tick between the ladder and the price gets a level.
+  std::size_t SizeIfInserted(Price price) const {
+    if (levels_.empty()) {
+      return 1;
+    }
+    const auto ticks = Traits::ToWire(price);
+    return static_cast<std::size_t>(std::max(low_ + Span() - 1, ticks) - std::min(low_, ticks) + 1);
+  }
+
+  bool Fits(Price price) const {
+    return SizeIfInserted(price) <= static_cast<std::size_t>(maxLevels);
+  }
+
+  std::size_t Bytes() const { return levels_.size() * sizeof(Limit); }
+
+private:
+  static constexpr std::int64_t npos_ = -1;
+
+  std::int64_t Span() const { return static_cast<std::int64_t>(levels_.size()); }
+
+  // Drops the empty levels at both ends, so the ladder only spans the prices with quantity.
+  void Trim() {
+    while (!levels_.empty() && levels_.front().totalQuantity == Quantity{}) {
+      levels_.pop_front();
+      ++low_;
+      if (best_ != npos_) {
+        --best_;
+      }
+    }
+    while (!levels_.empty() && levels_.back().totalQuantity == Quantity{}) {
+      levels_.pop_back();
+    }
+  }
+
+  std::deque<Limit, Allocator_T<Limit>> levels_;  // levels_[i] is the level at low_ + i ticks.
+  std::int64_t low_  = 0;
+  std::int64_t best_ = npos_;
+};
+
+/////////////////
+/// Policies
+/////////////////
+
+// Everything an OrderBook is generic over: how each side stores its levels, the queue of orders
+// at a level, the allocator for all of the above and the price and quantity types.
+template <template <typename, Side, template <typename> class> class Levels_T,
+          template <typename, typename> class Queue_T = std::list,
+          template <typename> class Allocator_T       = std::allocator,
+          typename Price_T = Price_type, typename Quantity_T = Quantity_type>
+struct BookPolicy {
+  using Price    = Price_T;
+  using Quantity = Quantity_T;
+
+  template <typename T>
+  using Allocator = Allocator_T<T>;
+
+  // Must keep iterators valid on insertion and erasure elsewhere in the queue.
+  template <typename T>
+  using Queue = Queue_T<T, Allocator_T<T>>;
+
+  template <typename Limit, Side S>
+  using Levels = Levels_T<Limit, S, Allocator_T>;
+};
+
+using TreePolicy           = BookPolicy<TreeLevels>;
+using FlatPolicy           = BookPolicy<FlatLevels>;
+using LadderPolicy         = BookPolicy<LadderLevels>;
+using PooledTreePolicy     = BookPolicy<TreeLevels, std::list, PoolAllocator>;
+using PooledLadderPolicy   = BookPolicy<LadderLevels, std::list, PoolAllocator>;
+using FixedPointTreePolicy =
+    BookPolicy<TreeLevels, std::list, std::allocator, FixedPoint64<10'000>, std::int64_t>;
+
+// Calls func.template operator()<Policy>(name) for each of the policies above, for the tools that
+// run the same thing against all of them.
+template <typename F>
+void ForEachPolicy(F&& func) {
+  func.template operator()<TreePolicy>("Tree");
+  func.template operator()<FlatPolicy>("Flat");
+  func.template operator()<LadderPolicy>("Ladder");
+  func.template operator()<PooledTreePolicy>("PooledTree");
+  func.template operator()<PooledLadderPolicy>("PooledLadder");
+  func.template operator()<FixedPointTreePolicy>("FixedPointTree");
+}
+
+#endif  // #ifndef BOOK_POLICIES_H
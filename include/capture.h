@@ -0,0 +1,461 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/////////////////
+/// std
+/////////////////
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "order_book.h"
+
+// Binary capture of the orders the books were given, in the order they were given them, with the
+// time each one arrived. Layout (integers little endian):
+//
+//   CaptureHeader
+//   block, block, ...
+//
+// and each block is a CaptureBlockHeader followed by storedBytes of payload, zlib compressed if
+// the block's COMPRESSED flag is set. The payload is columnar, each column holding numOrders
+// values (or one per BUY/SELL for the last three) as LEB128 varints, signed ones zigzag encoded:
+//
+//   symbols      Symbols first used in this block: count, then length and bytes of each. They are
+//                numbered from 0 in order of first use across the whole file.
+//   orderTypes   One byte each.
+//   timestamps   Difference from the previous order's, the first from the block's firstTimestamp.
+//   userIds      Difference from the previous order's.
+//   userOrderIds Difference from the same user's previous order in the block, or from 0.
+//   symbolIds    BUY/SELL only.
+//   prices       BUY/SELL only. Difference from the previous price of the symbol in the block.
+//   quantities   BUY/SELL only.
+//
+// Blocks only depend on earlier blocks for the symbol table, so a reader goes through the file
+// front to back, a block at a time.
+
+struct CaptureHeader {
+  char magic[8]                 = {'O', 'B', 'C', 'A', 'P', 'T', 'U', 'R'};
+  std::uint32_t version         = 1;
+  std::uint32_t reserved        = 0;
+  std::int64_t startSystemNanos = 0;  // system_clock when the capture started.
+  std::int64_t startSteadyNanos = 0;  // steady_clock at the same moment, timestamps use it.
+};
+
+struct CaptureBlockHeader {
+  enum Flags : std::uint32_t { COMPRESSED = 1 };
+
+  std::uint32_t numOrders     = 0;
+  std::uint32_t flags         = 0;
+  std::uint32_t rawBytes      = 0;  // Of the payload, once decompressed.
+  std::uint32_t storedBytes   = 0;  // Of the payload, in the file.
+  std::int64_t firstTimestamp = 0;
+};
+
+// CANCEL and FLUSH orders only keep their ids, that is all the books use.
+struct CapturedOrder {
+  std::int64_t timestamp = 0;  // Arrival, steady_clock nanoseconds.
+  Order order;
+};
+
+// Whether the order has the symbol, price and quantity columns.
+inline bool IsNewOrder(const Order& order) {
+  return order.orderType == Order::OrderType::BUY || order.orderType == Order::OrderType::SELL;
+}
+
+/////////////////
+/// Varints
+/////////////////
+
+inline void PutVarint(std::string& out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+inline void PutSignedVarint(std::string& out, std::int64_t value) {
+  PutVarint(out,
+            (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+}
+
+inline std::uint64_t GetVarint(const char*& pos, const char* end) {
+  std::uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos == end) {
+      throw std::runtime_error("Truncated varint in capture.");
+    }
+    const auto byte = static_cast<std::uint8_t>(*pos++);
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Overlong varint in capture.");
+}
+
+inline std::int64_t GetSignedVarint(const char*& pos, const char* end) {
+  const auto value = GetVarint(pos, end);
+  return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+/////////////////
+/// Writer
+/////////////////
+
+// Collects orders into blocks of CAPTURE_BLOCK_ORDERS and appends each one to the file once it is
+// full, or on Flush(). Not thread safe, see CaptureManager for recording from the server.
+class CaptureWriter {
+public:
+  CaptureWriter(const std::string& fileName, bool compress) : compress_(compress) {
+    file_ = std::fopen(fileName.c_str(), "wb");
+    if (file_ == nullptr) {
+      throw std::runtime_error("Error opening capture " + fileName + " for writing.");
+    }
+    CaptureHeader header;
+    header.startSystemNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+    header.startSteadyNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now().time_since_epoch())
+                                  .count();
+    Write(&header, sizeof(header));
+    orders_.reserve(CAPTURE_BLOCK_ORDERS);
+  }
+
+  // Never throws. A block that can't be written is lost, as is anything after a failed write, so
+  // the capture ends with the blocks written before the failure.
+  ~CaptureWriter() {
+    if (!failed_) {
+      try {
+        Flush();
+      } catch (const std::exception&) {
+      }
+    }
+    std::fclose(file_);
+  }
+
+  CaptureWriter(const CaptureWriter&)  = delete;
+  void operator=(const CaptureWriter&) = delete;
+
+  void Add(std::int64_t timestamp, const Order& order) {
+    orders_.push_back({timestamp, order});
+    if (orders_.size() == CAPTURE_BLOCK_ORDERS) {
+      Flush();
+    }
+  }
+
+  // Writes what has been added so far as a block.
+  void Flush() {
+    if (orders_.empty()) {
+      return;
+    }
+    Encode();
+    CaptureBlockHeader header;
+    header.numOrders      = static_cast<std::uint32_t>(orders_.size());
+    header.rawBytes       = static_cast<std::uint32_t>(payload_.size());
+    header.firstTimestamp = orders_.front().timestamp;
+
+    const std::string* stored = &payload_;
+    if (compress_) {
+      auto compressedBytes = compressBound(payload_.size());
+      compressed_.resize(compressedBytes);
+      if (compress2(reinterpret_cast<Bytef*>(compressed_.data()), &compressedBytes,
+                    reinterpret_cast<const Bytef*>(payload_.data()), payload_.size(),
+                    Z_BEST_SPEED) != Z_OK) {
+        throw std::runtime_error("Error compressing capture block.");
+      }
+      compressed_.resize(compressedBytes);
+      // Keep whichever is smaller.
+      if (compressed_.size() < payload_.size()) {
+        header.flags |= CaptureBlockHeader::COMPRESSED;
+        stored = &compressed_;
+      }
+    }
+    header.storedBytes = static_cast<std::uint32_t>(stored->size());
+    Write(&header, sizeof(header));
+    Write(stored->data(), stored->size());
+    writtenOrders_ += orders_.size();
+    orders_.clear();
+    if (std::fflush(file_) != 0) {
+      failed_ = true;
+      throw std::runtime_error("Error writing capture.");
+    }
+  }
+
+  std::uint64_t WrittenBytes() const { return writtenBytes_; }
+  std::uint64_t WrittenOrders() const { return writtenOrders_; }
+
+private:
+  void Encode() {
+    payload_.clear();
+
+    // Symbols, first use in this block.
+    std::vector<std::uint32_t> symbolIds;
+    std::vector<const Symbol_type*> newSymbols;
+    for (const auto& [timestamp, order] : orders_) {
+      if (!IsNewOrder(order)) {
+        continue;
+      }
+      auto [it, inserted] =
+          symbolIds_.try_emplace(order.symbol, static_cast<std::uint32_t>(symbolIds_.size()));
+      if (inserted) {
+        newSymbols.push_back(&it->first);
+      }
+      symbolIds.push_back(it->second);
+    }
+    PutVarint(payload_, newSymbols.size());
+    for (const auto* symbol : newSymbols) {
+      PutVarint(payload_, symbol->size());
+      payload_ += *symbol;
+    }
+
+    for (const auto& [timestamp, order] : orders_) {
+      payload_.push_back(static_cast<char>(order.orderType));
+    }
+    auto lastTimestamp = orders_.front().timestamp;
+    for (const auto& [timestamp, order] : orders_) {
+      PutSignedVarint(payload_, timestamp - lastTimestamp);
+      lastTimestamp = timestamp;
+    }
+    std::int64_t lastUserId = 0;
+    for (const auto& [timestamp, order] : orders_) {
+      PutSignedVarint(payload_, std::int64_t{order.userId} - lastUserId);
+      lastUserId = order.userId;
+    }
+    lastUserOrderIds_.clear();
+    for (const auto& [timestamp, order] : orders_) {
+      auto& lastUserOrderId = lastUserOrderIds_[order.userId];
+      PutSignedVarint(payload_, std::int64_t{order.userOrderId} - lastUserOrderId);
+      lastUserOrderId = order.userOrderId;
+    }
+    for (const auto symbolId : symbolIds) {
+      PutVarint(payload_, symbolId);
+    }
+    lastPrices_.assign(symbolIds_.size(), 0);
+    for (std::size_t i = 0; const auto& [timestamp, order] : orders_) {
+      if (IsNewOrder(order)) {
+        auto& lastPrice = lastPrices_[symbolIds[i++]];
+        PutSignedVarint(payload_, std::int64_t{order.price} - lastPrice);
+        lastPrice = order.price;
+      }
+    }
+    for (const auto& [timestamp, order] : orders_) {
+      if (IsNewOrder(order)) {
+        PutSignedVarint(payload_, order.quantity);
+      }
+    }
+  }
+
+  void Write(const void* data, std::size_t size) {
+    if (std::fwrite(data, 1, size, file_) != size) {
+      failed_ = true;
+      throw std::runtime_error("Error writing capture.");
+    }
+    writtenBytes_ += size;
+  }
+
+  std::FILE* file_ = nullptr;
+  bool compress_;
+  bool failed_ = false;  // A write failed, the file may end in part of a block.
+  std::vector<CapturedOrder> orders_;  // The block being collected.
+  std::unordered_map<Symbol_type, std::uint32_t> symbolIds_;
+  std::unordered_map<UserId_type, std::int64_t> lastUserOrderIds_;
+  std::vector<std::int64_t> lastPrices_;
+  std::string payload_;
+  std::string compressed_;
+  std::uint64_t writtenBytes_  = 0;
+  std::uint64_t writtenOrders_ = 0;
+};
+
+/////////////////
+/// Reader
+/////////////////
+
+// Deflate's best case is 258 bytes from a 1 bit code plus a 1 bit distance, so a block never
+// inflates by more than this.
+static constexpr std::uint64_t ZLIB_MAX_RATIO = 1032;
+
+// Maps a capture into memory and decodes it a block at a time. Pages are only read as blocks are
+// decoded, so a capture far larger than memory can be replayed.
+class CaptureReader {
+public:
+  explicit CaptureReader(const std::string& fileName) {
+    fd_ = open(fileName.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      throw std::runtime_error("Error opening capture " + fileName + ".");
+    }
+    struct stat fileStat {};
+    if (fstat(fd_, &fileStat) < 0) {
+      close(fd_);
+      throw std::runtime_error("Error reading the size of capture " + fileName + ".");
+    }
+    size_ = static_cast<std::size_t>(fileStat.st_size);
+    if (size_ < sizeof(CaptureHeader)) {
+      close(fd_);
+      throw std::runtime_error(fileName + " is not a capture.");
+    }
+    data_ = static_cast<const char*>(mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0));
+    if (data_ == MAP_FAILED) {
+      close(fd_);
+      throw std::runtime_error("Error mapping capture " + fileName + ".");
+    }
+    madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+    std::memcpy(&header_, data_, sizeof(header_));
+    if (std::memcmp(header_.magic, CaptureHeader{}.magic, sizeof(header_.magic)) != 0 ||
+        header_.version != CaptureHeader{}.version) {
+      munmap(const_cast<char*>(data_), size_);
+      close(fd_);
+      throw std::runtime_error(fileName + " is not a capture, or of an unknown version.");
+    }
+    offset_ = sizeof(CaptureHeader);
+  }
+
+  ~CaptureReader() {
+    munmap(const_cast<char*>(data_), size_);
+    close(fd_);
+  }
+
+  CaptureReader(const CaptureReader&)  = delete;
+  void operator=(const CaptureReader&) = delete;
+
+  const CaptureHeader& Header() const { return header_; }
+
+  // Replaces orders with the next block's. Returns false at the end of the capture.
+  bool Next(std::vector<CapturedOrder>& orders) {
+    orders.clear();
+    if (offset_ == size_) {
+      return false;
+    }
+    CaptureBlockHeader header;
+    if (size_ - offset_ < sizeof(header)) {
+      throw std::runtime_error("Truncated capture block header.");
+    }
+    std::memcpy(&header, data_ + offset_, sizeof(header));
+    offset_ += sizeof(header);
+    if (size_ - offset_ < header.storedBytes) {
+      throw std::runtime_error("Truncated capture block.");
+    }
+    // Checked before anything is sized from the header.
+    if (header.numOrders > CAPTURE_BLOCK_ORDERS ||
+        header.rawBytes > ZLIB_MAX_RATIO * std::uint64_t{header.storedBytes}) {
+      throw std::runtime_error("Corrupt capture block header.");
+    }
+    const char* payload = data_ + offset_;
+    offset_ += header.storedBytes;
+    if (header.flags & CaptureBlockHeader::COMPRESSED) {
+      decompressed_.resize(header.rawBytes);
+      auto rawBytes = static_cast<uLongf>(header.rawBytes);
+      if (uncompress(reinterpret_cast<Bytef*>(decompressed_.data()), &rawBytes,
+                     reinterpret_cast<const Bytef*>(payload), header.storedBytes) != Z_OK ||
+          rawBytes != header.rawBytes) {
+        throw std::runtime_error("Error decompressing capture block.");
+      }
+      payload = decompressed_.data();
+    } else if (header.rawBytes != header.storedBytes) {
+      throw std::runtime_error("Corrupt capture block header.");
+    }
+    Decode(header, payload, payload + header.rawBytes, orders);
+    return true;
+  }
+
+private:
+  // The inverse of CaptureWriter::Encode().
+  void Decode(const CaptureBlockHeader& header, const char* pos, const char* end,
+              std::vector<CapturedOrder>& orders) {
+    const auto numSymbols = GetVarint(pos, end);
+    for (std::uint64_t i = 0; i < numSymbols; ++i) {
+      const auto length = GetVarint(pos, end);
+      if (static_cast<std::uint64_t>(end - pos) < length) {
+        throw std::runtime_error("Truncated symbol in capture.");
+      }
+      symbols_.emplace_back(pos, length);
+      pos += length;
+    }
+
+    if (static_cast<std::size_t>(end - pos) < header.numOrders) {
+      throw std::runtime_error("Truncated order types in capture.");
+    }
+    orders.resize(header.numOrders);
+    for (auto& [timestamp, order] : orders) {
+      const auto orderType = static_cast<std::uint8_t>(*pos++);
+      if (orderType > static_cast<std::uint8_t>(Order::OrderType::FLUSH)) {
+        throw std::runtime_error("Invalid order type in capture.");
+      }
+      order.orderType = static_cast<Order::OrderType>(orderType);
+    }
+    auto lastTimestamp = header.firstTimestamp;
+    for (auto& [timestamp, order] : orders) {
+      timestamp     = lastTimestamp + GetSignedVarint(pos, end);
+      lastTimestamp = timestamp;
+    }
+    std::int64_t lastUserId = 0;
+    for (auto& [timestamp, order] : orders) {
+      order.userId = static_cast<UserId_type>(lastUserId + GetSignedVarint(pos, end));
+      lastUserId   = order.userId;
+    }
+    lastUserOrderIds_.clear();
+    for (auto& [timestamp, order] : orders) {
+      auto& lastUserOrderId = lastUserOrderIds_[order.userId];
+      order.userOrderId     = static_cast<UserOrderId_type>(lastUserOrderId +
+                                                        GetSignedVarint(pos, end));
+      lastUserOrderId       = order.userOrderId;
+    }
+    symbolIds_.clear();
+    for (auto& [timestamp, order] : orders) {
+      if (IsNewOrder(order)) {
+        const auto symbolId = GetVarint(pos, end);
+        if (symbolId >= symbols_.size()) {
+          throw std::runtime_error("Unknown symbol in capture.");
+        }
+        order.symbol = symbols_[symbolId];
+        symbolIds_.push_back(static_cast<std::uint32_t>(symbolId));
+      }
+    }
+    lastPrices_.assign(symbols_.size(), 0);
+    for (std::size_t i = 0; auto& [timestamp, order] : orders) {
+      if (IsNewOrder(order)) {
+        auto& lastPrice = lastPrices_[symbolIds_[i++]];
+        order.price     = static_cast<Price_type>(lastPrice + GetSignedVarint(pos, end));
+        lastPrice       = order.price;
+      }
+    }
+    for (auto& [timestamp, order] : orders) {
+      if (IsNewOrder(order)) {
+        order.quantity = static_cast<Quantity_type>(GetSignedVarint(pos, end));
+      }
+    }
+    if (pos != end) {
+      throw std::runtime_error("Trailing bytes in capture block.");
+    }
+  }
+
+  int fd_             = -1;
+  const char* data_   = nullptr;
+  std::size_t size_   = 0;
+  std::size_t offset_ = 0;  // Of the next block.
+  CaptureHeader header_;
+  std::vector<Symbol_type> symbols_;  // Symbol table, grows block by block.
+  std::unordered_map<UserId_type, std::int64_t> lastUserOrderIds_;
+  std::vector<std::uint32_t> symbolIds_;
+  std::vector<std::int64_t> lastPrices_;
+  std::string decompressed_;
+};
+
+#endif  // #ifndef CAPTURE_H
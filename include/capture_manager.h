@@ -0,0 +1,151 @@
+#ifndef CAPTURE_MANAGER_H
+#define CAPTURE_MANAGER_H
+
+/////////////////
+/// std
+/////////////////
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+/////////////////
+/// local
+/////////////////
+#include "capture.h"
+#include "config.h"
+#include "order_book.h"
+#include "spsc_queue.h"
+
+struct CaptureStats {
+  std::uint64_t capturedOrders = 0;  // In the blocks written so far.
+  std::uint64_t writtenBytes   = 0;
+  std::uint64_t queueStalls    = 0;  // Times the matching thread found the queue full and waited.
+  std::uint64_t writeFailures  = 0;  // The capture stops at the first.
+  std::uint64_t droppedOrders  = 0;  // Not recorded because of a write failure.
+};
+
+// Records the server's order flow to a capture file (see capture.h). The matching thread pushes
+// every order it is about to apply into a lock-free queue, and a separate thread encodes them and
+// writes the blocks, so matching never waits on the disk unless the queue fills up. A partial
+// block is written after CAPTURE_FLUSH_MS without orders, so little is lost if the server dies.
+//
+// If a write fails (disk full, say) capturing stops: the error is logged and counted, the orders
+// not yet written are dropped, and the server carries on matching. The capture replays up to the
+// block that failed.
+class CaptureManager {
+public:
+  using Clock      = std::chrono::steady_clock;
+  using Queue_type = SPSCQueue<CapturedOrder, CAPTURE_QUEUE_CAPACITY>;
+
+  CaptureManager(const std::string& fileName, bool compress)
+      : writer_(fileName, compress), queue_(std::make_unique<Queue_type>()) {
+    thread_ = std::jthread(&CaptureManager::Run, this);
+  }
+
+  ~CaptureManager() { Stop(); }
+
+  CaptureManager(const CaptureManager&) = delete;
+  void operator=(const CaptureManager&) = delete;
+
+  // Called by the matching thread, in the order the orders are applied. A replay must see every
+  // order, so a full queue is waited out (and counted) rather than dropped.
+  void Push(Clock::time_point receiveTime, const Order& order) {
+    if (failed_.load(std::memory_order_relaxed)) {
+      droppedOrders_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    CapturedOrder captured{
+        std::chrono::duration_cast<std::chrono::nanoseconds>(receiveTime.time_since_epoch())
+            .count(),
+        order};
+    while (!queue_->TryPush(std::move(captured))) {
+      queueStalls_.fetch_add(1, std::memory_order_relaxed);
+      std::this_thread::yield();
+    }
+  }
+
+  // Writes everything still queued and waits for it.
+  void Stop() {
+    stopFlag_ = true;
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  CaptureStats GetStats() const {
+    return {capturedOrders_.load(std::memory_order_relaxed),
+            writtenBytes_.load(std::memory_order_relaxed),
+            queueStalls_.load(std::memory_order_relaxed),
+            (failed_.load(std::memory_order_relaxed)) ? 1u : 0u,
+            unwrittenOrders_.load(std::memory_order_relaxed) +
+                droppedOrders_.load(std::memory_order_relaxed)};
+  }
+
+private:
+  void Run() {
+    auto lastOrder         = Clock::now();
+    bool pending           = false;  // Orders added since the last block was written.
+    std::uint64_t consumed = 0;      // Orders taken off the queue.
+    while (true) {
+      const auto stopping = stopFlag_.load();
+      const auto count    = queue_->ConsumeBatch(
+          [&](CapturedOrder&& captured) {
+            TryWrite([&] { writer_.Add(captured.timestamp, captured.order); });
+          },
+          CAPTURE_BLOCK_ORDERS);
+      const auto now = Clock::now();
+      if (count > 0) {
+        lastOrder = now;
+        pending   = true;
+      } else if (pending && (stopping ||
+                             now - lastOrder >= std::chrono::milliseconds(CAPTURE_FLUSH_MS))) {
+        TryWrite([&] { writer_.Flush(); });
+        pending = false;
+      }
+      consumed += count;
+      capturedOrders_.store(writer_.WrittenOrders(), std::memory_order_relaxed);
+      writtenBytes_.store(writer_.WrittenBytes(), std::memory_order_relaxed);
+      if (failed_.load(std::memory_order_relaxed)) {
+        unwrittenOrders_.store(consumed - writer_.WrittenOrders(), std::memory_order_relaxed);
+      }
+      if (count == 0) {
+        if (stopping) {
+          break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  // Runs write() on the writer, unless an earlier write failed.
+  template <typename F>
+  void TryWrite(F&& write) {
+    if (failed_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    try {
+      write();
+    } catch (const std::exception& e) {
+      failed_.store(true, std::memory_order_relaxed);
+      std::cerr << "Capture stopped: " << e.what() << '\n';
+    }
+  }
+
+  CaptureWriter writer_;
+  std::unique_ptr<Queue_type> queue_;
+  std::atomic<bool> stopFlag_                 = false;
+  std::atomic<bool> failed_                   = false;
+  std::atomic<std::uint64_t> capturedOrders_  = 0;
+  std::atomic<std::uint64_t> writtenBytes_    = 0;
+  std::atomic<std::uint64_t> queueStalls_     = 0;
+  std::atomic<std::uint64_t> droppedOrders_   = 0;  // By Push(), once the capture stopped.
+  std::atomic<std::uint64_t> unwrittenOrders_ = 0;  // Taken off the queue but never written.
+  std::jthread thread_;
+};
+
+#endif  // #ifndef CAPTURE_MANAGER_H
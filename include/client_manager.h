@@ -6,15 +6,22 @@
 /////////////////
 #include <unistd.h>
 
+#include <array>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <tuple>
 
 /////////////////
 /// local
 /////////////////
+#include "config.h"
 #include "order_book.h"
+#include "report_manager.h"
 #include "serialization.h"
 #include "socket_wrappers.h"
 
@@ -31,6 +38,8 @@ public:
   // Blocks on destruction to flush queue.
   ~ClientManager() {
     FlushQueue();
+    recvStopFlag_ = true;
+    recvThread_.join();
 
     freeaddrinfo(clientAddrInfo_);
     close(clientFd_);
@@ -42,7 +51,25 @@ public:
     cv_.notify_one();
   }
 
+  // Called on the receive thread for every event in every execution report from the server.
+  void SetReportHandler(std::function<void(const Event&)> handler) {
+    std::scoped_lock lock(reportMutex_);
+    reportHandler_ = std::move(handler);
+  }
+
+  // Time from sending an order to receiving its acknowledgement (or cancel confirmation).
+  std::vector<std::chrono::nanoseconds> GetRoundTrips() {
+    std::scoped_lock lock(reportMutex_);
+    return roundTrips_;
+  }
+
+  std::size_t GetReceivedReports() const { return receivedReports_; }
+
+  // Datagrams on the report socket that weren't execution reports.
+  std::size_t GetDecodeErrors() const { return decodeErrors_; }
+
 private:
+  using SentKey_type = std::tuple<UserId_type, UserOrderId_type, bool>;  // isCancel
   void FlushQueue() {
     std::unique_lock uniqueLock(mutex_);
     cv_.wait(uniqueLock, [&] { return orderQueue_.empty(); });
@@ -69,13 +96,65 @@ private:
 
   void SendOrder(Order order) {
     static socklen_t clientAddrInfoLen = sizeof(addrinfo);
+    {
+      std::scoped_lock lock(reportMutex_);
+      sendTimes_.insert_or_assign(
+          SentKey_type{order.userId, order.userOrderId,
+                       order.orderType == Order::OrderType::CANCEL},
+          std::chrono::steady_clock::now());
+    }
     SerializeAndSend(std::move(order), clientFd_, clientAddrInfo_->ai_addr, clientAddrInfoLen);
   }
 
+  // Execution reports arrive on the same socket the orders leave from.
+  void Receive() {
+    std::array<char, MAX_DATAGRAM_SIZE> buffer;
+    while (!recvStopFlag_) {
+      const auto readStatus = recv(clientFd_, buffer.data(), buffer.size(), 0);
+      if (readStatus < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Error recving in ClientManager::Receive.");
+      }
+      const auto receiveTime = std::chrono::steady_clock::now();
+      ExecutionReport report;
+      try {
+        DeserializeObject(report, buffer.data(), readStatus);
+      } catch (const std::exception&) {
+        ++decodeErrors_;  // Malformed or truncated, skip it.
+        continue;
+      }
+      ++receivedReports_;
+
+      std::scoped_lock lock(reportMutex_);
+      bool afterCancel = false;
+      for (const auto& event : report.events) {
+        // A cancel is confirmed by a C event followed by an A event for a server generated id,
+        // only the C event closes the round trip.
+        const auto isAck    = (event.eventType == Event::EventType::ACK && !afterCancel);
+        const auto isCancel = (event.eventType == Event::EventType::CANCEL);
+        if (isAck || isCancel) {
+          auto it = sendTimes_.find(SentKey_type{event.userId, event.userOrderId, isCancel});
+          if (it != sendTimes_.end()) {
+            roundTrips_.push_back(receiveTime - it->second);
+            sendTimes_.erase(it);
+          }
+        }
+        afterCancel = isCancel;
+        if (reportHandler_) {
+          reportHandler_(event);
+        }
+      }
+    }
+  }
+
   ClientManager() {
     SetAddrInfo(&clientAddrInfo_);
     SetSocket(clientAddrInfo_, clientFd_);
-    thread_ = std::jthread(&ClientManager::Run, this);
+    SetRecvTimeout(clientFd_, std::chrono::milliseconds(100));
+    thread_     = std::jthread(&ClientManager::Run, this);
+    recvThread_ = std::jthread(&ClientManager::Receive, this);
   }
 
   std::jthread thread_;
@@ -85,6 +164,15 @@ private:
   std::condition_variable cv_;
   addrinfo* clientAddrInfo_ = nullptr;
   int clientFd_             = -1;
+
+  std::jthread recvThread_;
+  std::atomic<bool> recvStopFlag_           = false;
+  std::atomic<std::size_t> receivedReports_ = 0;
+  std::atomic<std::size_t> decodeErrors_    = 0;
+  std::mutex reportMutex_;
+  std::function<void(const Event&)> reportHandler_;
+  std::map<SentKey_type, std::chrono::steady_clock::time_point> sendTimes_;
+  std::vector<std::chrono::nanoseconds> roundTrips_;
 };
 
 #endif  // #ifndef CLIENT_MANAGER_H
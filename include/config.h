@@ -1,7 +1,70 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+/////////////////
+/// std
+/////////////////
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
 static const auto FILE_PATH = std::string(__FILE__);
 static const auto ROOT_DIR  = FILE_PATH.substr(0, FILE_PATH.rfind("/")) + "/..";
 
+// Ingest front end.
+static constexpr std::size_t NUM_INGEST_SOCKETS       = 4;        // SO_REUSEPORT sockets/threads.
+static constexpr int INGEST_RECV_BUFFER_BYTES         = 8 << 20;  // SO_RCVBUF per socket.
+static constexpr std::size_t INGEST_BATCH_SIZE        = 64;       // Datagrams per recvmmsg().
+static constexpr std::size_t INGEST_QUEUE_CAPACITY    = 1 << 14;  // Orders per ingest queue.
+static constexpr std::size_t MAX_DATAGRAM_SIZE        = 2048;
+static constexpr int SERVER_IDLE_TIMEOUT_SECONDS      = 2;
+
+// Threads polling an empty queue, see IdleBackoff.
+static constexpr int IDLE_SPIN_MICROS  = 1000;  // Polled flat out this long after the last work.
+static constexpr int IDLE_SLEEP_MICROS = 200;   // Then polled this often.
+
+// Admission control, see admission_control.h.
+static constexpr std::int64_t USER_ORDER_RATE        = 200'000;  // Orders per second per user.
+static constexpr std::int64_t USER_ORDER_BURST       = 20'000;   // Orders a user may send at once.
+static constexpr std::size_t USER_BUCKETS            = 1 << 16;
+static constexpr std::uint32_t SYMBOL_MAX_IN_FLIGHT  = 1 << 13;  // Queued, unmatched orders.
+static constexpr std::size_t SYMBOL_SLOTS            = 1 << 12;
+static constexpr std::size_t INGEST_SHED_THRESHOLD   = INGEST_QUEUE_CAPACITY / 4 * 3;
+static constexpr std::size_t REJECT_QUEUE_CAPACITY   = 1 << 12;  // Rejects per ingest socket.
+
+// Matching.
+static constexpr std::size_t ORDER_PREFETCH_DISTANCE  = 4;        // Orders between prefetch stages.
+
+// Memory caps, see memory_stats.h.
+static constexpr std::size_t BOOK_MAX_RESTING_ORDERS  = 1 << 20;  // Per book.
+static constexpr std::size_t BOOK_MAX_LEVELS          = 1 << 16;  // Per side of a book.
+static constexpr std::size_t SERVER_MAX_QUEUED_EVENTS = 1 << 22;  // Server log events unwritten.
+
+// Trade analytics, see trade_analytics.h.
+static constexpr std::size_t ANALYTICS_MAX_SYMBOLS = 1 << 10;
+static constexpr std::int64_t ANALYTICS_BAR_MS     = 1000;  // Length of a bar.
+static constexpr std::size_t ANALYTICS_BARS        = 60;    // Bars kept per symbol.
+
+// Execution reports.
+static constexpr std::size_t REPORT_QUEUE_CAPACITY    = 1 << 14;  // Orders' worth of events.
+static constexpr std::size_t REPORT_BATCH_SIZE        = 256;      // Orders coalesced per send.
+static constexpr std::size_t MAX_EVENTS_PER_REPORT    = 64;       // Fits in MAX_DATAGRAM_SIZE.
+
+// Replication to a hot standby.
+static constexpr std::size_t REPLICATION_QUEUE_CAPACITY  = 1 << 16;  // Orders.
+static constexpr std::size_t REPLICATION_BATCH_SIZE      = 16;       // Orders per datagram.
+static constexpr std::size_t REPLICATION_DATAGRAM_SIZE   = 1 << 16;  // Fits any batch.
+static constexpr std::size_t REPLICATION_MAX_PENDING     = 1 << 16;  // Out of order orders held.
+static constexpr std::size_t REPLICATION_RESEND_WINDOW   = 1 << 18;  // Orders kept for resends.
+static constexpr std::size_t REPLICATION_SNAPSHOT_CHUNK  = 1 << 15;  // Snapshot bytes per datagram.
+static constexpr std::size_t REPLICATION_SNAPSHOT_WINDOW = 4;        // Chunks sent per request.
+static constexpr int REPLICATION_HEARTBEAT_MS            = 5;
+static constexpr int REPLICATION_RESEND_MS               = 5;   // Between two resend requests.
+static constexpr int REPLICATION_TAKEOVER_MS             = 50;  // Primary silence before takeover.
+
+// Capture of the order flow, see capture.h.
+static constexpr std::size_t CAPTURE_QUEUE_CAPACITY = 1 << 16;  // Orders.
+static constexpr std::size_t CAPTURE_BLOCK_ORDERS   = 4096;     // Orders per block.
+static constexpr int CAPTURE_FLUSH_MS               = 100;      // Longest a partial block waits.
+
 #endif  // #ifndef CONFIG_H
@@ -0,0 +1,103 @@
+#ifndef DIFFERENTIAL_FUZZER_H
+#define DIFFERENTIAL_FUZZER_H
+
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "load_generator.h"
+#include "order_book.h"
+#include "reference_order_book.h"
+
+struct FuzzConfig {
+  OrderFlowConfig orderFlow;
+  std::size_t numOrders   = 1'000'000;
+  std::size_t numUsers    = 4;
+  double flushProbability = 1e-3;
+  std::size_t maxBatch    = 64;  // Orders are handed to HandleOrders() in batches up to this size.
+  std::uint64_t seed      = 1;
+};
+
+// The first order on which the books and the reference disagreed.
+struct FuzzMismatch {
+  std::size_t index;  // Of the order in the stream.
+  Order order;
+  std::optional<std::vector<Event>> expected;  // From the reference.
+  std::optional<std::vector<Event>> actual;
+};
+
+std::string to_string(const std::optional<std::vector<Event>>& events) {
+  if (!events) {
+    return "  (none)\n";
+  }
+  std::string str;
+  for (const auto& event : *events) {
+    str += "  " + to_string(event) + "\n";
+  }
+  return str;
+}
+
+std::string to_string(const FuzzMismatch& mismatch) {
+  return "Order " + std::to_string(mismatch.index) + ": " + to_string(mismatch.order) +
+         "\nexpected:\n" + to_string(mismatch.expected) + "actual:\n" + to_string(mismatch.actual);
+}
+
+// A reasonably varied order flow for a seed: a few symbols, shallow books so that orders cross
+// often and sweep several levels, and small quantities so that partial fills are common.
+OrderFlowConfig FuzzOrderFlow(std::uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  OrderFlowConfig config;
+  config.symbols         = {"AAPL", "IBM", "MSFT"};
+  config.startPrice      = 100;
+  config.depth           = std::uniform_int_distribution<Price_type>(1, 8)(rng);
+  config.walkProbability = 0.1;
+  config.maxQuantity     = std::uniform_int_distribution<Quantity_type>(1, 50)(rng);
+  config.addWeight       = 0.5;
+  config.cancelWeight    = std::uniform_real_distribution<double>(0.05, 0.4)(rng);
+  config.aggressWeight   = std::uniform_real_distribution<double>(0.05, 0.4)(rng);
+  return config;
+}
+
+// Feeds the same stream of orders to books using Policy and to ReferenceOrderBooks, and compares
+// the events each order produces. The books get the orders in randomly sized batches through
+// HandleOrders(), so the prefetching path is checked along with the matching itself.
+template <typename Policy>
+std::optional<FuzzMismatch> FuzzAgainstReference(const FuzzConfig& config) {
+  BasicOrderBooks<Policy> books;
+  ReferenceOrderBooks reference;
+  InterleavedOrderFlow orderFlow(config.orderFlow, config.numUsers, config.flushProbability,
+                                 config.seed);
+  std::mt19937_64 rng(config.seed);
+  std::uniform_int_distribution<std::size_t> batchSize(1, config.maxBatch);
+
+  std::vector<Order> batch;
+  std::vector<Order> copies;
+  std::optional<FuzzMismatch> mismatch;
+  for (std::size_t done = 0; done < config.numOrders && !mismatch;) {
+    batch.resize(std::min(batchSize(rng), config.numOrders - done));
+    std::generate(batch.begin(), batch.end(), [&] { return orderFlow.Next(); });
+    copies = batch;
+    books.HandleOrders(std::span<Order>(batch),
+                       [&](std::size_t i, std::optional<std::vector<Event>>&& actual) {
+                         auto expected = reference.HandleOrder(copies[i]);
+                         if (!mismatch && expected != actual) {
+                           mismatch = FuzzMismatch{done + i, copies[i], std::move(expected),
+                                                   std::move(actual)};
+                         }
+                       });
+    done += batch.size();
+  }
+  return mismatch;
+}
+
+#endif  // #ifndef DIFFERENTIAL_FUZZER_H
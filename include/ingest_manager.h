@@ -0,0 +1,275 @@
+#ifndef INGEST_MANAGER_H
+#define INGEST_MANAGER_H
+
+/////////////////
+/// std
+/////////////////
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "admission_control.h"
+#include "config.h"
+#include "order_book.h"
+#include "serialization.h"
+#include "socket_wrappers.h"
+#include "spsc_queue.h"
+
+// An order as decoded by an ingest thread, stamped with where and when it arrived.
+struct InboundOrder {
+  Order order;
+  std::uint64_t sequence = 0;  // Per-socket arrival sequence number.
+  std::size_t socketId   = 0;
+  std::chrono::steady_clock::time_point receiveTime;
+  sockaddr_storage source{};
+  socklen_t sourceLen      = 0;
+  std::uint32_t symbolSlot = AdmissionControl::noSlot;  // Hand back with IngestManager::Release().
+};
+
+// An order turned away by admission control, to be reported back to whoever sent it.
+struct RejectNotice {
+  Event event;
+  sockaddr_storage source{};
+  socklen_t sourceLen = 0;
+};
+
+struct IngestStats {
+  struct Socket {
+    std::uint64_t datagrams    = 0;
+    std::uint64_t decodeErrors = 0;
+    std::uint64_t kernelDrops  = 0;  // SO_RXQ_OVFL, datagrams dropped because the buffer was full.
+    std::uint64_t queueStalls  = 0;  // Times the matching stage queue was full and we had to wait.
+    std::uint64_t rateLimited  = 0;  // Rejected by admission control, see AdmissionControl.
+    std::uint64_t symbolCapped = 0;
+    std::uint64_t shed         = 0;
+    std::uint64_t rejectsLost  = 0;  // Rejects not reported because the reject queue was full.
+    int recvBufferBytes        = 0;
+  };
+  std::vector<Socket> sockets;
+};
+
+// N SO_REUSEPORT sockets bound to the same port, each drained by its own thread with recvmmsg().
+// Each thread decodes a batch of datagrams and hands it to the matching stage through its own
+// lock-free queue. The kernel pins a client to one socket, so arrival order per client is preserved.
+// Orders are put through admission control on the way, rejects go into a second queue per socket
+// for the report thread.
+class IngestManager {
+public:
+  using Queue_type       = SPSCQueue<InboundOrder, INGEST_QUEUE_CAPACITY>;
+  using RejectQueue_type = SPSCQueue<RejectNotice, REJECT_QUEUE_CAPACITY>;
+
+  explicit IngestManager(std::size_t numSockets = NUM_INGEST_SOCKETS) : sockets_(numSockets) {
+    for (std::size_t i = 0; i < numSockets; ++i) {
+      auto& socket = sockets_[i];
+      SetAddrInfo(&socket.addrInfo);
+      SetSocket(socket.addrInfo, socket.fd, 1);
+      SetReusePort(socket.fd);
+      socket.recvBufferBytes = SetRecvBufferSize(socket.fd, INGEST_RECV_BUFFER_BYTES);
+      EnableDropCounter(socket.fd);
+      BindSocket(socket.addrInfo, socket.fd);
+      socket.queue   = std::make_unique<Queue_type>();
+      socket.rejects = std::make_unique<RejectQueue_type>();
+    }
+    for (std::size_t i = 0; i < numSockets; ++i) {
+      sockets_[i].thread = std::jthread(&IngestManager::Receive, this, i);
+    }
+  }
+
+  ~IngestManager() {
+    Stop();
+    for (auto& socket : sockets_) {
+      if (socket.thread.joinable()) {
+        socket.thread.join();
+      }
+      freeaddrinfo(socket.addrInfo);
+      close(socket.fd);
+    }
+  }
+
+  IngestManager(const IngestManager&)  = delete;
+  void operator=(const IngestManager&) = delete;
+
+  void Stop() { stopFlag_ = true; }
+
+  // Called by the matching thread. Visits the queues round robin, taking up to maxPerSocket orders
+  // from each, and returns the number of orders handed to func.
+  template <typename F>
+  std::size_t Poll(F&& func, std::size_t maxPerSocket = INGEST_BATCH_SIZE) {
+    std::size_t count = 0;
+    for (auto& socket : sockets_) {
+      count += socket.queue->ConsumeBatch(func, maxPerSocket);
+    }
+    return count;
+  }
+
+  // Called by the matching thread once it has handled an order from Poll().
+  void Release(const InboundOrder& inbound) { admission_.Release(inbound.symbolSlot); }
+
+  // Called by one consumer thread, the report thread. Same as Poll(), for rejected orders.
+  template <typename F>
+  std::size_t PollRejects(F&& func, std::size_t maxPerSocket = INGEST_BATCH_SIZE) {
+    std::size_t count = 0;
+    for (auto& socket : sockets_) {
+      count += socket.rejects->ConsumeBatch(func, maxPerSocket);
+    }
+    return count;
+  }
+
+  IngestStats GetStats() const {
+    IngestStats stats;
+    for (const auto& socket : sockets_) {
+      stats.sockets.push_back({socket.datagrams.load(std::memory_order_relaxed),
+                               socket.decodeErrors.load(std::memory_order_relaxed),
+                               socket.kernelDrops.load(std::memory_order_relaxed),
+                               socket.queueStalls.load(std::memory_order_relaxed),
+                               socket.rateLimited.load(std::memory_order_relaxed),
+                               socket.symbolCapped.load(std::memory_order_relaxed),
+                               socket.shed.load(std::memory_order_relaxed),
+                               socket.rejectsLost.load(std::memory_order_relaxed),
+                               socket.recvBufferBytes});
+    }
+    return stats;
+  }
+
+  // Any bound socket can be used to send replies from the server port.
+  int GetFd(std::size_t socketId = 0) const { return sockets_[socketId].fd; }
+
+  std::size_t NumSockets() const { return sockets_.size(); }
+
+private:
+  struct Socket {
+    int fd              = -1;
+    addrinfo* addrInfo  = nullptr;
+    int recvBufferBytes = 0;
+    std::unique_ptr<Queue_type> queue;
+    std::unique_ptr<RejectQueue_type> rejects;
+    std::jthread thread;
+    std::atomic<std::uint64_t> datagrams    = 0;
+    std::atomic<std::uint64_t> decodeErrors = 0;
+    std::atomic<std::uint64_t> kernelDrops  = 0;
+    std::atomic<std::uint64_t> queueStalls  = 0;
+    std::atomic<std::uint64_t> rateLimited  = 0;
+    std::atomic<std::uint64_t> symbolCapped = 0;
+    std::atomic<std::uint64_t> shed         = 0;
+    std::atomic<std::uint64_t> rejectsLost  = 0;
+  };
+
+  void Receive(std::size_t socketId) {
+    auto& socket = sockets_[socketId];
+
+    // Everything recvmmsg() needs is allocated once up front.
+    static constexpr std::size_t controlSize = CMSG_SPACE(sizeof(std::uint32_t));
+    std::vector<std::array<char, MAX_DATAGRAM_SIZE>> buffers(INGEST_BATCH_SIZE);
+    std::vector<std::array<char, controlSize>> controls(INGEST_BATCH_SIZE);
+    std::vector<sockaddr_storage> sources(INGEST_BATCH_SIZE);
+    std::vector<iovec> iovecs(INGEST_BATCH_SIZE);
+    std::vector<mmsghdr> headers(INGEST_BATCH_SIZE);
+    std::vector<InboundOrder> batch(INGEST_BATCH_SIZE);
+    std::uint64_t sequence = 0;
+
+    while (!stopFlag_) {
+      for (std::size_t i = 0; i < INGEST_BATCH_SIZE; ++i) {
+        iovecs[i]                         = {buffers[i].data(), buffers[i].size()};
+        headers[i].msg_hdr                = {};
+        headers[i].msg_hdr.msg_name       = &sources[i];
+        headers[i].msg_hdr.msg_namelen    = sizeof(sockaddr_storage);
+        headers[i].msg_hdr.msg_iov        = &iovecs[i];
+        headers[i].msg_hdr.msg_iovlen     = 1;
+        headers[i].msg_hdr.msg_control    = controls[i].data();
+        headers[i].msg_hdr.msg_controllen = controls[i].size();
+      }
+      // Blocks (up to the socket timeout) for the first datagram, then takes whatever else is ready.
+      const auto received = recvmmsg(socket.fd, headers.data(), INGEST_BATCH_SIZE, MSG_WAITFORONE,
+                                     nullptr);
+      if (received < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Error recving in IngestManager::Receive.");
+      }
+
+      const auto receiveTime = std::chrono::steady_clock::now();
+      const auto saturated   = (socket.queue->SizeApprox() + received >= INGEST_SHED_THRESHOLD);
+      std::size_t decoded    = 0;
+      for (int i = 0; i < received; ++i) {
+        auto& header = headers[i].msg_hdr;
+        for (auto* cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+          if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            std::uint32_t drops = 0;
+            std::memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            socket.kernelDrops.store(drops, std::memory_order_relaxed);
+          }
+        }
+        auto& inbound = batch[decoded];
+        try {
+          DeserializeObject(inbound.order, buffers[i].data(), headers[i].msg_len);
+        } catch (const std::exception&) {
+          socket.decodeErrors.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
+        const auto reason =
+            admission_.Admit(inbound.order, receiveTime, saturated, inbound.symbolSlot);
+        if (reason.has_value()) {
+          Reject(socket, inbound.order, *reason, sources[i], header.msg_namelen);
+          continue;
+        }
+        inbound.sequence    = sequence++;
+        inbound.socketId    = socketId;
+        inbound.receiveTime = receiveTime;
+        inbound.source      = sources[i];
+        inbound.sourceLen   = header.msg_namelen;
+        ++decoded;
+      }
+      socket.datagrams.fetch_add(received, std::memory_order_relaxed);
+
+      // Never drop a decoded order in process: if the matching stage is behind, wait for it and let
+      // the kernel buffer (and its drop counter) absorb the burst.
+      auto first = batch.begin();
+      auto last  = batch.begin() + decoded;
+      while (first != last) {
+        first += socket.queue->TryPushBatch(first, last);
+        if (first != last) {
+          socket.queueStalls.fetch_add(1, std::memory_order_relaxed);
+          std::this_thread::yield();
+        }
+      }
+    }
+  }
+
+  void Reject(Socket& socket, const Order& order, Event::RejectReason reason,
+              const sockaddr_storage& source, socklen_t sourceLen) {
+    switch (reason) {
+      case (Event::RejectReason::RATE_LIMIT):
+        socket.rateLimited.fetch_add(1, std::memory_order_relaxed);
+        break;
+      case (Event::RejectReason::SYMBOL_IN_FLIGHT):
+        socket.symbolCapped.fetch_add(1, std::memory_order_relaxed);
+        break;
+      default:
+        socket.shed.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+    // Best effort, like all reports. Waiting here would let a flood of rejects hold up good orders.
+    if (!socket.rejects->TryPush({Event::Reject(order.userId, order.userOrderId, reason), source,
+                                  sourceLen})) {
+      socket.rejectsLost.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  AdmissionControl admission_;
+  std::vector<Socket> sockets_;
+  std::atomic<bool> stopFlag_ = false;
+};
+
+#endif  // #ifndef INGEST_MANAGER_H
@@ -0,0 +1,352 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+/////////////////
+/// std
+/////////////////
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "order_book.h"
+#include "report_manager.h"
+#include "serialization.h"
+#include "socket_wrappers.h"
+
+struct OrderFlowConfig {
+  std::vector<Symbol_type> symbols = {"AAPL", "IBM", "MSFT", "TSLA"};
+  Price_type startPrice            = 1000;
+  Price_type depth                 = 10;    // Passive orders rest within this many ticks of mid.
+  double walkProbability           = 0.05;  // Chance that a symbol's mid moves a tick per order.
+  Quantity_type maxQuantity        = 100;
+  // Relative weights of the three kinds of order.
+  double addWeight     = 0.6;  // Passive limit order.
+  double cancelWeight  = 0.3;  // Cancel of one of our own earlier orders.
+  double aggressWeight = 0.1;  // Order crossing the spread, a market order half of the time.
+};
+
+// Synthesizes an endless, reproducible stream of orders for one user. Each symbol's mid price does a
+// random walk, passive orders rest around it and aggressive orders cross it. User order ids are
+// firstOrderId, firstOrderId + orderIdStride, ... so several generators never share an id.
+class OrderFlowGenerator {
+public:
+  OrderFlowGenerator(const OrderFlowConfig& config, UserId_type userId,
+                     UserOrderId_type firstOrderId, UserOrderId_type orderIdStride,
+                     std::uint64_t seed)
+      : config_(config),
+        userId_(userId),
+        nextOrderId_(firstOrderId),
+        orderIdStride_(orderIdStride),
+        mids_(config.symbols.size(), config.startPrice),
+        rng_(seed),
+        kind_({config.addWeight, config.cancelWeight, config.aggressWeight}) {
+    if (config_.symbols.empty()) {
+      throw std::runtime_error("OrderFlowGenerator needs at least one symbol.");
+    }
+  }
+
+  UserId_type UserId() const { return userId_; }
+
+  Order Next() {
+    Order order;
+    order.userId = userId_;
+    const auto kind = kind_(rng_);
+    if (kind == 1 && !live_.empty()) {
+      // Cancel a random earlier order, filled or not.
+      const auto index  = std::uniform_int_distribution<std::size_t>(0, live_.size() - 1)(rng_);
+      order.orderType   = Order::OrderType::CANCEL;
+      order.userOrderId = live_[index];
+      live_[index]      = live_.back();
+      live_.pop_back();
+      return order;
+    }
+
+    const auto symbolIndex =
+        std::uniform_int_distribution<std::size_t>(0, config_.symbols.size() - 1)(rng_);
+    auto& mid = mids_[symbolIndex];
+    if (std::bernoulli_distribution(config_.walkProbability)(rng_)) {
+      mid = std::max(config_.depth + 1, mid + (std::bernoulli_distribution(0.5)(rng_) ? 1 : -1));
+    }
+
+    const auto isBuy  = std::bernoulli_distribution(0.5)(rng_);
+    order.orderType   = (isBuy) ? Order::OrderType::BUY : Order::OrderType::SELL;
+    order.symbol      = config_.symbols[symbolIndex];
+    order.quantity    = std::uniform_int_distribution<Quantity_type>(1, config_.maxQuantity)(rng_);
+    order.userOrderId = nextOrderId_;
+    nextOrderId_ += orderIdStride_;
+    if (kind == 2) {
+      if (std::bernoulli_distribution(0.5)(rng_)) {
+        order.price = 0;  // Market order.
+      } else {
+        order.price = (isBuy) ? mid + config_.depth : mid - config_.depth;
+      }
+    } else {
+      const auto offset = std::uniform_int_distribution<Price_type>(1, config_.depth)(rng_);
+      order.price       = (isBuy) ? mid - offset : mid + offset;
+    }
+
+    if (order.price != 0) {
+      if (live_.size() == maxLive_) {
+        live_[std::uniform_int_distribution<std::size_t>(0, maxLive_ - 1)(rng_)] = live_.back();
+        live_.pop_back();
+      }
+      live_.push_back(order.userOrderId);
+    }
+    return order;
+  }
+
+private:
+  static constexpr std::size_t maxLive_ = 4096;  // Orders we remember as cancel candidates.
+
+  OrderFlowConfig config_;
+  UserId_type userId_;
+  UserOrderId_type nextOrderId_;
+  UserOrderId_type orderIdStride_;
+  std::vector<Price_type> mids_;
+  std::vector<UserOrderId_type> live_;
+  std::mt19937_64 rng_;
+  std::discrete_distribution<int> kind_;
+};
+
+// Several users' order flow merged into one reproducible stream, as a single matching thread would
+// see it, for driving the books in process. Users firstUserId, firstUserId + 1, ... take turns at
+// random, so they trade with each other and, now and then, try to trade with themselves. A FLUSH
+// is mixed in with probability flushProbability per order, which also keeps the books small.
+class InterleavedOrderFlow {
+public:
+  InterleavedOrderFlow(const OrderFlowConfig& config, std::size_t numUsers, double flushProbability,
+                       std::uint64_t seed, UserId_type firstUserId = 1)
+      : rng_(seed), user_(0, numUsers - 1), flush_(flushProbability) {
+    if (numUsers == 0) {
+      throw std::runtime_error("InterleavedOrderFlow needs at least one user.");
+    }
+    for (std::size_t i = 0; i < numUsers; ++i) {
+      generators_.emplace_back(config, firstUserId + static_cast<UserId_type>(i),
+                               static_cast<UserOrderId_type>(i + 1),
+                               static_cast<UserOrderId_type>(numUsers), seed * numUsers + i);
+    }
+  }
+
+  Order Next() {
+    if (flush_(rng_)) {
+      Order flush;
+      flush.orderType = Order::OrderType::FLUSH;
+      return flush;
+    }
+    return generators_[user_(rng_)].Next();
+  }
+
+private:
+  std::vector<OrderFlowGenerator> generators_;
+  std::mt19937_64 rng_;
+  std::uniform_int_distribution<std::size_t> user_;
+  std::bernoulli_distribution flush_;
+};
+
+// Sleeps while the deadline is far away and spins for the last stretch, so pacing is accurate to
+// well under the kernel's wakeup granularity.
+inline void WaitUntil(std::chrono::steady_clock::time_point deadline) {
+  static constexpr auto spinThreshold = std::chrono::microseconds(100);
+  while (true) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      return;
+    }
+    if (deadline - now > spinThreshold * 2) {
+      std::this_thread::sleep_for(deadline - now - spinThreshold);
+    }
+  }
+}
+
+struct LoadGeneratorConfig {
+  OrderFlowConfig orderFlow;
+  double rate                            = 100'000;  // Orders per second, over all threads.
+  std::size_t numThreads                 = 4;
+  std::chrono::duration<double> duration = std::chrono::seconds(10);
+  UserId_type firstUserId                = 1000;   // Thread i sends as user firstUserId + i.
+  std::uint64_t seed                     = 1;
+  bool flush                             = false;  // Send FLUSH when done, so the log is written.
+};
+
+struct LoadGeneratorResult {
+  std::uint64_t sent       = 0;
+  std::uint64_t sendErrors = 0;  // Datagrams the kernel refused, e.g. ENOBUFS.
+  std::uint64_t acked      = 0;  // Orders and cancels confirmed by an execution report.
+  std::uint64_t rejected   = 0;  // Turned away by the server's admission control.
+  std::chrono::duration<double> elapsed{};
+  std::vector<std::chrono::nanoseconds> latencies;  // Sorted.
+};
+
+// Open loop load generator: every thread sends on a fixed schedule from its own socket, whatever the
+// server does, so a slow server shows up as latency instead of quietly lowering the offered rate.
+// Round trips are measured from the scheduled send time to the acknowledgement, which keeps
+// coordinated omission out of the percentiles.
+class LoadGenerator {
+public:
+  explicit LoadGenerator(const LoadGeneratorConfig& config) : config_(config) {
+    if (!(config_.rate > 0) || config_.numThreads == 0) {
+      throw std::runtime_error("LoadGenerator needs a positive rate and at least one thread.");
+    }
+  }
+
+  LoadGeneratorResult Run() {
+    const auto ordersPerThread = static_cast<std::size_t>(
+        config_.rate * config_.duration.count() / static_cast<double>(config_.numThreads));
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(config_.numThreads) / config_.rate));
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (std::size_t i = 0; i < config_.numThreads; ++i) {
+      workers.push_back(std::make_unique<Worker>(config_, i, ordersPerThread));
+    }
+
+    // Threads are started with a small lead so they all share the same time zero.
+    const auto start = Clock::now() + std::chrono::milliseconds(10);
+    {
+      std::vector<std::jthread> threads;
+      for (auto& worker : workers) {
+        threads.emplace_back(&Worker::Receive, worker.get());
+        threads.emplace_back(&Worker::Send, worker.get(), start, interval);
+      }
+    }
+
+    LoadGeneratorResult result;
+    for (auto& worker : workers) {
+      result.sent += worker->sent;
+      result.sendErrors += worker->sendErrors;
+      result.acked += worker->latencies.size();
+      result.rejected += worker->rejected;
+      result.latencies.insert(result.latencies.end(), worker->latencies.begin(),
+                              worker->latencies.end());
+      result.elapsed = std::max(result.elapsed, worker->elapsed);
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+
+    if (config_.flush) {
+      Order flush;
+      flush.orderType = Order::OrderType::FLUSH;
+      SerializeAndSend(flush, workers.front()->fd, workers.front()->addrInfo->ai_addr,
+                       workers.front()->addrInfo->ai_addrlen);
+    }
+    return result;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Worker {
+    Worker(const LoadGeneratorConfig& config, std::size_t index, std::size_t numOrders)
+        : generator(config.orderFlow, config.firstUserId + static_cast<UserId_type>(index),
+                    static_cast<UserOrderId_type>(index + 1),
+                    static_cast<UserOrderId_type>(config.numThreads), config.seed + index),
+          stride(config.numThreads),
+          numOrders(numOrders),
+          sendTimes(numOrders),
+          cancelTimes(numOrders) {
+      SetAddrInfo(&addrInfo);
+      SetSocket(addrInfo, fd);
+      SetRecvTimeout(fd, std::chrono::milliseconds(100));
+      latencies.reserve(numOrders);
+    }
+
+    ~Worker() {
+      freeaddrinfo(addrInfo);
+      close(fd);
+    }
+
+    void Send(Clock::time_point start, Clock::duration interval) {
+      for (std::size_t i = 0; i < numOrders; ++i) {
+        const auto order = generator.Next();
+        const auto due   = start + interval * i;
+        WaitUntil(due);
+        // Add orders are keyed by their id, cancels by the id of the order they cancel.
+        const auto slot = static_cast<std::size_t>(order.userOrderId - 1) / stride;
+        auto& sendTime  = (order.orderType == Order::OrderType::CANCEL) ? cancelTimes : sendTimes;
+        if (slot < numOrders) {
+          sendTime[slot].store(due.time_since_epoch().count(), std::memory_order_release);
+        }
+        const auto serializedOrder = SerializeObject(order);
+        if (sendto(fd, serializedOrder.data(), serializedOrder.size(), 0, addrInfo->ai_addr,
+                   addrInfo->ai_addrlen) < 0) {
+          ++sendErrors;
+        } else {
+          ++sent;
+        }
+      }
+      elapsed = Clock::now() - start;
+      // Give the last reports time to arrive.
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      sendDone = true;
+    }
+
+    void Receive() {
+      std::array<char, MAX_DATAGRAM_SIZE> buffer;
+      while (!sendDone) {
+        const auto readStatus = recv(fd, buffer.data(), buffer.size(), 0);
+        if (readStatus < 0) {
+          continue;  // Timeout, or nothing sent yet so the socket isn't bound.
+        }
+        const auto receiveTime = Clock::now().time_since_epoch().count();
+        ExecutionReport report;
+        try {
+          DeserializeObject(report, buffer.data(), readStatus);
+        } catch (const std::exception&) {
+          continue;
+        }
+        bool afterCancel = false;
+        for (const auto& event : report.events) {
+          if (event.eventType == Event::EventType::REJECT && event.userId == generator.UserId()) {
+            ++rejected;
+            continue;
+          }
+          const auto isAck    = (event.eventType == Event::EventType::ACK && !afterCancel);
+          const auto isCancel = (event.eventType == Event::EventType::CANCEL);
+          afterCancel         = isCancel;
+          if ((!isAck && !isCancel) || event.userId != generator.UserId()) {
+            continue;
+          }
+          const auto slot = static_cast<std::size_t>(event.userOrderId - 1) / stride;
+          if (slot >= numOrders) {
+            continue;
+          }
+          auto& sendTime    = (isCancel) ? cancelTimes[slot] : sendTimes[slot];
+          const auto sentAt = sendTime.exchange(0, std::memory_order_acq_rel);
+          if (sentAt != 0) {
+            latencies.emplace_back(receiveTime - sentAt);
+          }
+        }
+      }
+    }
+
+    OrderFlowGenerator generator;
+    std::size_t stride;
+    std::size_t numOrders;
+    addrinfo* addrInfo = nullptr;
+    int fd             = -1;
+    std::vector<std::atomic<Clock::rep>> sendTimes;
+    std::vector<std::atomic<Clock::rep>> cancelTimes;
+    std::vector<std::chrono::nanoseconds> latencies;
+    std::uint64_t sent       = 0;
+    std::uint64_t sendErrors = 0;
+    std::uint64_t rejected   = 0;
+    std::chrono::duration<double> elapsed{};
+    std::atomic<bool> sendDone = false;
+  };
+
+  LoadGeneratorConfig config_;
+};
+
+#endif  // #ifndef LOAD_GENERATOR_H
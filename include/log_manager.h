@@ -0,0 +1,167 @@
+#ifndef LOG_MANAGER_H
+#define LOG_MANAGER_H
+
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "order_book.h"
+
+struct LogStats {
+  std::size_t queuedEventsHighWater = 0;
+  std::uint64_t writtenChunks       = 0;  // Written ahead of the FLUSH that ends their round.
+};
+
+// The server log. The matching thread adds the events of every order it applies, and a separate
+// thread writes them to <directory>/<round>.log and standard out, one file per round of orders up
+// to a FLUSH. A FLUSH waits for its round to be written.
+//
+// Once half of maxQueuedEvents are held, what is there is written out ahead of the FLUSH, to the
+// same file and without holding up the matching thread. The log is only full if writing falls that
+// far behind, and even then cancels, which shrink the books, and FLUSHes are admitted.
+class LogManager {
+public:
+  LogManager(const std::string& directory, std::size_t maxQueuedEvents, bool echo = true)
+      : directory_(directory),
+        maxQueuedEvents_(maxQueuedEvents),
+        chunkEvents_(std::max<std::size_t>(maxQueuedEvents / 2, 1)),
+        echo_(echo) {
+    thread_ = std::jthread(&LogManager::Publish, this);
+  }
+
+  ~LogManager() { Stop(); }
+
+  LogManager(const LogManager&)     = delete;
+  void operator=(const LogManager&) = delete;
+
+  // Called by the matching thread, before the order is matched, replicated or captured.
+  bool Admits(const Order& order) const {
+    return order.orderType == Order::OrderType::CANCEL ||
+           order.orderType == Order::OrderType::FLUSH ||
+           queuedEvents_.load(std::memory_order_relaxed) < maxQueuedEvents_;
+  }
+
+  // Called by the matching thread.
+  void Add(const std::vector<Event>& events) {
+    std::unique_lock uniqueLock(mutex_);
+    for (const auto& event : events) {
+      serverLog_.push(event);
+    }
+    queuedEvents_          = serverLog_.size();
+    queuedEventsHighWater_ = std::max(queuedEventsHighWater_, serverLog_.size());
+    if (serverLog_.size() >= chunkEvents_) {
+      cv_.notify_all();
+    }
+  }
+
+  // Called by the matching thread. Ends the round, and returns once all of it is written.
+  void Flush() {
+    std::unique_lock uniqueLock(mutex_);
+    flushing_ = true;
+    cv_.notify_all();
+    cv_.wait(uniqueLock, [&] { return !flushing_ || stopFlag_; });
+  }
+
+  // Drops whatever has not been written yet.
+  void Stop() {
+    {
+      std::unique_lock uniqueLock(mutex_);
+      stopFlag_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  LogStats GetStats() const {
+    std::unique_lock uniqueLock(mutex_);
+    return {queuedEventsHighWater_, writtenChunks_};
+  }
+
+private:
+  void Publish() {
+    std::unique_lock uniqueLock(mutex_);
+    while (true) {
+      cv_.wait(uniqueLock,
+               [&] { return stopFlag_ || flushing_ || serverLog_.size() >= chunkEvents_; });
+      if (stopFlag_) {
+        break;
+      }
+      std::queue<Event> events;
+      std::swap(events, serverLog_);
+      queuedEvents_         = 0;
+      const auto endOfRound = flushing_;
+      uniqueLock.unlock();
+      Write(events, endOfRound);
+      uniqueLock.lock();
+      if (endOfRound) {
+        flushing_ = false;
+        cv_.notify_all();
+      } else {
+        ++writtenChunks_;
+      }
+    }
+  }
+
+  // Appends to the round's file, opening it at the round's first event. No events, no file.
+  void Write(std::queue<Event>& events, bool endOfRound) {
+    if (!events.empty() && !outputFile_.is_open()) {
+      ++id_;
+      if (echo_) {
+        std::cout << "============Writing Log " << id_ << "============\n";
+      }
+      outputFile_.open(directory_ + "/" + std::to_string(id_) + ".log");
+      if (!outputFile_.is_open()) {
+        throw std::runtime_error("Couldn't write to outputFile in LogManager::Write");
+      }
+    }
+    while (!events.empty()) {
+      auto logMsg = to_string(events.front());
+      events.pop();
+      outputFile_ << logMsg << '\n';
+      if (echo_) {
+        std::cout << logMsg << '\n';
+      }
+    }
+    if (endOfRound && outputFile_.is_open()) {
+      outputFile_.close();
+    } else {
+      outputFile_.flush();
+    }
+  }
+
+  std::string directory_;
+  std::size_t maxQueuedEvents_;
+  std::size_t chunkEvents_;  // Written out ahead of the FLUSH from this many on.
+  bool echo_;                // Also to standard out.
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::queue<Event> serverLog_;
+  std::atomic<std::size_t> queuedEvents_ = 0;  // serverLog_.size(), read without the lock.
+  std::size_t queuedEventsHighWater_     = 0;
+  std::uint64_t writtenChunks_           = 0;
+  bool flushing_                         = false;
+  bool stopFlag_                         = false;
+  std::ofstream outputFile_;  // Publish thread, the round's file.
+  int id_ = 0;                // Publish thread, the round.
+  std::jthread thread_;
+};
+
+#endif  // #ifndef LOG_MANAGER_H
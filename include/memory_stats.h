@@ -0,0 +1,83 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+/////////////////
+/// std
+/////////////////
+#include <cstddef>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "types.h"
+
+// Estimated heap bytes of the standard containers, from their sizes. Nodes are the element plus the
+// container's links: two pointers for a list, three and a colour for a map, a next pointer and the
+// cached hash for an unordered_map, which also has its bucket array. Allocator overhead and pooled
+// nodes that are free are not counted.
+template <typename T>
+constexpr std::size_t ListBytes(std::size_t size) {
+  return size * (sizeof(T) + 2 * sizeof(void*));
+}
+
+template <typename Map_T>
+std::size_t TreeMapBytes(const Map_T& map) {
+  return map.size() * (sizeof(typename Map_T::value_type) + 4 * sizeof(void*));
+}
+
+template <typename Map_T>
+std::size_t HashMapBytes(const Map_T& map) {
+  return map.size() * (sizeof(typename Map_T::value_type) + 2 * sizeof(void*)) +
+         map.bucket_count() * sizeof(void*);
+}
+
+template <typename Vector_T>
+std::size_t VectorBytes(const Vector_T& vector) {
+  return vector.capacity() * sizeof(typename Vector_T::value_type);
+}
+
+// One structure's footprint. The high water mark is the most elements it has held, it survives
+// FLUSH.
+struct StructureMemory {
+  std::size_t elements          = 0;
+  std::size_t bytes             = 0;
+  std::size_t highWaterElements = 0;
+};
+
+struct BookMemoryStats {
+  Symbol_type symbol;
+  StructureMemory orders;      // Resting orders: the order index and the queues at each level.
+  StructureMemory buyLevels;   // Levels the container holds, empty ones included.
+  StructureMemory sellLevels;
+  std::size_t rejectedOrders = 0;  // Remainders not rested because of the BookLimits.
+
+  std::size_t Bytes() const { return orders.bytes + buyLevels.bytes + sellLevels.bytes; }
+};
+
+struct MemoryStats {
+  std::vector<BookMemoryStats> books;
+  StructureMemory orderBooks;     // The books themselves, keyed by symbol.
+  StructureMemory orderIdMap;     // Which book each resting order is in.
+  StructureMemory maxOrderIdMap;  // Last order id of each user.
+  StructureMemory replicationLog;  // Orders a primary keeps for its standby's resends.
+  std::size_t rejectedOrders = 0;  // By every book, including those gone with a FLUSH.
+
+  std::size_t Bytes() const {
+    auto bytes = orderBooks.bytes + orderIdMap.bytes + maxOrderIdMap.bytes + replicationLog.bytes;
+    for (const auto& book : books) {
+      bytes += book.Bytes();
+    }
+    return bytes;
+  }
+};
+
+// Caps on what one book may hold. A remainder that would break one is not rested, and is rejected
+// with BOOK_FULL instead.
+struct BookLimits {
+  std::size_t maxRestingOrders = BOOK_MAX_RESTING_ORDERS;
+  std::size_t maxLevels        = BOOK_MAX_LEVELS;  // Per side.
+};
+
+#endif  // #ifndef MEMORY_STATS_H
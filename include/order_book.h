@@ -4,20 +4,28 @@
 /////////////////
 /// std
 /////////////////
+#include <algorithm>
 #include <chrono>
 #include <functional>
-#include <list>
-#include <map>
+#include <iterator>
+#include <optional>
+#include <span>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
 #include<iostream>
-// Defining types
-using UserId_type      = int;
-using Symbol_type      = std::string;
-using OrderId_type     = int;
-using Price_type       = int;
-using Quantity_type    = int;
-using UserOrderId_type = int;
+
+/////////////////
+/// local
+/////////////////
+#include "book_policies.h"
+#include "config.h"
+#include "memory_stats.h"
+#include "trade_analytics.h"
+#include "types.h"
 
 struct Order {
   UserId_type userId       = -1;
@@ -60,241 +68,556 @@ std::string to_string(Order order) {
          std::to_string(order.userOrderId);
 }
 
-class OrderBook {
+// Output of the order books. Kept as plain data so the matching thread never formats strings, the
+// log line is produced by to_string() on the publishing side.
+struct Event {
+  enum class EventType : char {
+    ACK,          // A, userId, userOrderId
+    TRADE,        // T, userId (buy), userOrderId, otherUserId (sell), otherUserOrderId, price, quantity
+    TOP_OF_BOOK,  // B, side, price, quantity. Price and quantity are -1 if the side is empty.
+    CANCEL,       // C, userId, userOrderId, otherUserOrderId (the id acknowledging the cancel)
+    REJECT        // R, userId, userOrderId, reason. Turned away, or its remainder not rested.
+  } eventType;
+
+  enum class RejectReason : char {
+    NONE,
+    RATE_LIMIT,        // The user is sending faster than USER_ORDER_RATE.
+    SYMBOL_IN_FLIGHT,  // Too many orders for this symbol are waiting to be matched.
+    OVERLOAD,          // The server is overloaded, new orders are shed before cancels.
+    BOOK_FULL,         // The book is at one of its BookLimits, the remainder was not rested.
+    MEMORY_LIMIT,      // Writing the server log has fallen its maximum of events behind.
+    PRICE_RANGE        // The book's levels can't hold that price, the remainder was not rested.
+  };
+
+  UserId_type userId                = -1;
+  UserOrderId_type userOrderId      = -1;
+  UserId_type otherUserId           = -1;
+  UserOrderId_type otherUserOrderId = -1;
+  char side                         = ' ';
+  Price_type price                  = -1;
+  Quantity_type quantity            = -1;
+  RejectReason reason               = RejectReason::NONE;
+
+  static Event Ack(UserId_type userId, UserOrderId_type userOrderId) {
+    return {.eventType = EventType::ACK, .userId = userId, .userOrderId = userOrderId};
+  }
+
+  static Event Trade(UserId_type buyUserId, UserOrderId_type buyUserOrderId,
+                     UserId_type sellUserId, UserOrderId_type sellUserOrderId, Price_type price,
+                     Quantity_type quantity) {
+    return {.eventType        = EventType::TRADE,
+            .userId           = buyUserId,
+            .userOrderId      = buyUserOrderId,
+            .otherUserId      = sellUserId,
+            .otherUserOrderId = sellUserOrderId,
+            .price            = price,
+            .quantity         = quantity};
+  }
+
+  static Event TopOfBook(char side, Price_type price, Quantity_type quantity) {
+    return {.eventType = EventType::TOP_OF_BOOK, .side = side, .price = price, .quantity = quantity};
+  }
+
+  static Event Cancel(UserId_type userId, UserOrderId_type userOrderId,
+                      UserOrderId_type ackUserOrderId) {
+    return {.eventType        = EventType::CANCEL,
+            .userId           = userId,
+            .userOrderId      = userOrderId,
+            .otherUserOrderId = ackUserOrderId};
+  }
+
+  static Event Reject(UserId_type userId, UserOrderId_type userOrderId, RejectReason reason) {
+    return {.eventType   = EventType::REJECT,
+            .userId      = userId,
+            .userOrderId = userOrderId,
+            .reason      = reason};
+  }
+
+  bool operator==(const Event&) const = default;
+
+  template <typename Archive>
+  void serialize(Archive& archive) {
+    archive& eventType& userId& userOrderId& otherUserId& otherUserOrderId& side& price& quantity&
+        reason;
+  }
+};
+
+std::string to_string(Event::RejectReason reason) {
+  switch (reason) {
+    case (Event::RejectReason::NONE):
+      return "NONE";
+    case (Event::RejectReason::RATE_LIMIT):
+      return "RATE_LIMIT";
+    case (Event::RejectReason::SYMBOL_IN_FLIGHT):
+      return "SYMBOL_IN_FLIGHT";
+    case (Event::RejectReason::OVERLOAD):
+      return "OVERLOAD";
+    case (Event::RejectReason::BOOK_FULL):
+      return "BOOK_FULL";
+    case (Event::RejectReason::MEMORY_LIMIT):
+      return "MEMORY_LIMIT";
+    case (Event::RejectReason::PRICE_RANGE):
+      return "PRICE_RANGE";
+    default:
+      throw std::runtime_error("Invalid RejectReason");
+  }
+}
+
+std::string to_string(const Event& event) {
+  switch (event.eventType) {
+    case (Event::EventType::ACK):
+      return "A, " + std::to_string(event.userId) + ", " + std::to_string(event.userOrderId);
+    case (Event::EventType::TRADE):
+      return "T, " + std::to_string(event.userId) + ", " + std::to_string(event.userOrderId) +
+             ", " + std::to_string(event.otherUserId) + ", " +
+             std::to_string(event.otherUserOrderId) + ", " + std::to_string(event.price) + ", " +
+             std::to_string(event.quantity);
+    case (Event::EventType::TOP_OF_BOOK): {
+      const auto isEliminated = (event.quantity == -1);
+      return std::string("B, ") + event.side + ", " +
+             ((isEliminated) ? "-" : std::to_string(event.price)) + ", " +
+             ((isEliminated) ? "-" : std::to_string(event.quantity));
+    }
+    case (Event::EventType::CANCEL):
+      return "C, " + std::to_string(event.userId) + ", " + std::to_string(event.userOrderId) +
+             ", " + std::to_string(event.otherUserOrderId);
+    case (Event::EventType::REJECT):
+      return "R, " + std::to_string(event.userId) + ", " + std::to_string(event.userOrderId) +
+             ", " + to_string(event.reason);
+    default:
+      throw std::runtime_error("Invalid EventType");
+  }
+}
+
+// A resting order. Its price is the price of the Limit it sits in.
+template <typename Quantity_T>
+struct BookOrder {
+  UserId_type userId           = -1;
+  UserOrderId_type userOrderId = -1;
+  Quantity_T quantity{};
+};
+
+// A resting order as a snapshot of the books lists it, price and quantity in wire units.
+struct RestingOrderSnapshot {
+  Side side                    = Side::BUY;
+  Price_type price             = 0;
+  UserId_type userId           = -1;
+  UserOrderId_type userOrderId = -1;
+  Quantity_type quantity       = 0;
+
+  template <typename Archive>
+  void serialize(Archive& archive) {
+    archive& side& price& userId& userOrderId& quantity;
+  }
+};
+
+struct BookSnapshot {
+  Symbol_type symbol;
+  std::uint64_t policy = 0;  // Index into the OrderBooks' policies.
+  std::vector<RestingOrderSnapshot> orders;  // Level by level, each level's in queue order.
+
+  template <typename Archive>
+  void serialize(Archive& archive) {
+    archive& symbol& policy& orders;
+  }
+};
+
+struct MaxOrderIdSnapshot {
+  UserId_type userId           = -1;
+  UserOrderId_type userOrderId = -1;
+
+  template <typename Archive>
+  void serialize(Archive& archive) {
+    archive& userId& userOrderId;
+  }
+};
+
+// Everything the books match on, so that books loaded from it produce the same events as the ones
+// it was taken from. Trade analytics, limits and memory stats are not part of it.
+struct OrderBooksSnapshot {
+  std::vector<BookSnapshot> books;
+  std::vector<MaxOrderIdSnapshot> maxOrderIds;
+
+  template <typename Archive>
+  void serialize(Archive& archive) {
+    archive& books& maxOrderIds;
+  }
+};
+
+// One symbol's book, generic over a BookPolicy (see book_policies.h).
+template <typename Policy>
+class BasicOrderBook {
 public:
-  using List_type = std::list<Order>;
+  using Price          = typename Policy::Price;
+  using Quantity       = typename Policy::Quantity;
+  using BookOrder_type = BookOrder<Quantity>;
+  using List_type      = typename Policy::template Queue<BookOrder_type>;
 
   struct Limit {
-    int totalQuantity = 0;
+    Price price{};
+    Quantity totalQuantity{};
     List_type list;
   };
 
   struct OrderIt {
-    List_type* listPtr;
-    List_type::iterator it;
+    Limit* limitPtr;
+    typename List_type::iterator it;
   };
 
-  using OrderMap_type = std::unordered_map<OrderId_type, OrderIt>;
-  using Map_type      = std::map<Price_type, Limit>;  // BST
+  using OrderMap_type =
+      std::unordered_map<OrderId_type, OrderIt, std::hash<OrderId_type>,
+                         std::equal_to<OrderId_type>,
+                         typename Policy::template Allocator<std::pair<const OrderId_type, OrderIt>>>;
 
 private:
-  Map_type buySide_;
-  Map_type sellSide_;
+  using PriceTraits    = WireTraits<Price>;
+  using QuantityTraits = WireTraits<Quantity>;
+
+  typename Policy::template Levels<Limit, Side::BUY> buySide_;
+  typename Policy::template Levels<Limit, Side::SELL> sellSide_;
+  OrderMap_type orderMap_;  // This book's resting orders.
+  BookLimits limits_;
+  std::size_t ordersHighWater_     = 0;
+  std::size_t buyLevelsHighWater_  = 0;
+  std::size_t sellLevelsHighWater_ = 0;
+  std::size_t rejectedOrders_      = 0;
+
+  template <Side S>
+  auto& Levels() {
+    if constexpr (S == Side::BUY) {
+      return buySide_;
+    } else {
+      return sellSide_;
+    }
+  }
 
-  std::unordered_map<Price_type, Limit*> priceMap_;
+  static constexpr char SideChar(Side side) { return (side == Side::BUY) ? 'B' : 'S'; }
 
-  Map_type::reverse_iterator TOBBuySide_ = buySide_.rbegin();
-  Map_type::iterator TOBSellSide_        = sellSide_.begin();
+public:
+  BasicOrderBook() = default;
+  BasicOrderBook(const BasicOrderBook&) = delete;
+  void operator=(const BasicOrderBook&) = delete;
+
+  // orderIdMap indexes the resting orders of every book, mapping each one to bookRef.
+  template <typename OrderIdMap_T>
+  std::vector<Event> BuyOrder(Order order, OrderIdMap_T& orderIdMap,
+                              typename OrderIdMap_T::mapped_type bookRef) {
+    return AddOrder<Side::BUY>(std::move(order), orderIdMap, bookRef);
+  }
 
-  void UpdateTOBBuySide() {
-    for (TOBBuySide_ = buySide_.rbegin();
-         TOBBuySide_ != buySide_.rend() && TOBBuySide_->second.totalQuantity == 0; ++TOBBuySide_) {
-    }
+  template <typename OrderIdMap_T>
+  std::vector<Event> SellOrder(Order order, OrderIdMap_T& orderIdMap,
+                               typename OrderIdMap_T::mapped_type bookRef) {
+    return AddOrder<Side::SELL>(std::move(order), orderIdMap, bookRef);
   }
 
-  void UpdateTOBSellSide() {
-    for (TOBSellSide_ = sellSide_.begin();
-         TOBSellSide_ != sellSide_.end() && TOBSellSide_->second.totalQuantity == 0;
-         ++TOBSellSide_) {
+  // O(1). Returns false if the order is not resting in this book.
+  bool CancelOrder(OrderId_type userOrderId) {
+    auto orderIt = orderMap_.find(userOrderId);
+    if (orderIt == orderMap_.end()) {
+      return false;
     }
+    auto& limit = *orderIt->second.limitPtr;
+    limit.totalQuantity -= orderIt->second.it->quantity;
+    limit.list.erase(orderIt->second.it);
+    orderMap_.erase(orderIt);
+    if (limit.totalQuantity == Quantity{}) {
+      if (&limit == buySide_.Best()) {
+        buySide_.AdvanceBest();
+      } else if (&limit == sellSide_.Best()) {
+        sellSide_.AdvanceBest();
+      } else if (&limit == buySide_.Find(limit.price)) {
+        buySide_.Erase(limit);
+      } else {
+        sellSide_.Erase(limit);
+      }
+    }
+    return true;
   }
 
-public:
-  std::vector<std::string> BuyOrder(Order order, OrderMap_type& orderIdMap) {
-    std::vector<std::string> logVec;
-    {
-      std::stringstream logStr;
-      logStr << "A, " << order.userId << ", " << order.userOrderId;
-      logVec.push_back(logStr.str());
+  void SetLimits(const BookLimits& limits) { limits_ = limits; }
+
+  // Appends every resting order, a level at a time and each level's in queue order.
+  void Snapshot(std::vector<RestingOrderSnapshot>& orders) {
+    std::unordered_set<const Limit*> levels;
+    for (const auto& [_, orderIt] : orderMap_) {
+      const auto* limit = orderIt.limitPtr;
+      if (!levels.insert(limit).second) {
+        continue;
+      }
+      // A crossed book can have a level on each side at the same price.
+      const auto side = (limit == buySide_.Find(limit->price)) ? Side::BUY : Side::SELL;
+      for (const auto& bookOrder : limit->list) {
+        orders.push_back({side, static_cast<Price_type>(PriceTraits::ToWire(limit->price)),
+                          bookOrder.userId, bookOrder.userOrderId,
+                          static_cast<Quantity_type>(QuantityTraits::ToWire(bookOrder.quantity))});
+      }
     }
-    // Check sell side.
-    bool updateTOB = false;
-    while (TOBSellSide_ != sellSide_.end() && order.quantity > 0) {
-      // We need to first check if the TOBSellSide <= our order.price, or if we are placing a market
-      // order.
-      const auto& sellPrice = TOBSellSide_->first;
-      if (sellPrice <= order.price || order.price == 0) {
-        // We can trade.
-        const auto salePrice = sellPrice;
-        auto& sellLimit      = TOBSellSide_->second;
-        auto& sellList       = sellLimit.list;
-        auto it              = sellList.begin();
-        while (it != sellList.end() && order.quantity > 0) {
-          auto& sellOrder = *it;
-          if (sellOrder.userId == order.userId) {
-            // We can't trade with ourselves!
-            ++it;
-            continue;
-          }
-          const auto saleQuantity = std::min(order.quantity, sellOrder.quantity);
-          {
-            std::stringstream logStr;
-            logStr << "T, " << order.userId << ", " << order.userOrderId << ", " << sellOrder.userId
-                   << ", " << sellOrder.userOrderId << ", " << salePrice << ", " << saleQuantity;
-            logVec.push_back(logStr.str());
-          }
-          sellLimit.totalQuantity -= saleQuantity;
-          order.quantity -= saleQuantity;
-          if (saleQuantity == sellOrder.quantity) {
-            orderIdMap.erase(sellOrder.userOrderId);
-            it = sellList.erase(it);
-          }
-        }
-        updateTOB = true;
+  }
 
-        // We have taken all of the TOB on sell side. Update.
-        if (it == sellList.end()) {
-          UpdateTOBSellSide();
-        }
+  // Rests the orders of a Snapshot() as they were, without matching them: a book left crossed by
+  // the self-match rule stays crossed.
+  template <typename OrderIdMap_T>
+  void Restore(const std::vector<RestingOrderSnapshot>& orders, OrderIdMap_T& orderIdMap,
+               typename OrderIdMap_T::mapped_type bookRef) {
+    for (const auto& order : orders) {
+      const BookOrder_type bookOrder{order.userId, order.userOrderId,
+                                     QuantityTraits::FromWire(order.quantity)};
+      if (order.side == Side::BUY) {
+        RestOrder<Side::BUY>(PriceTraits::FromWire(order.price), bookOrder, orderIdMap, bookRef);
       } else {
-        break;
+        RestOrder<Side::SELL>(PriceTraits::FromWire(order.price), bookOrder, orderIdMap, bookRef);
       }
     }
+  }
 
-    if (updateTOB) {
-      const auto isEliminated = (TOBSellSide_ == sellSide_.end());
-      std::string TOBPrice    = (isEliminated) ? "-" : std::to_string(TOBSellSide_->first);
-      std::string TOBQuantity =
-          (isEliminated) ? "-" : std::to_string(TOBSellSide_->second.totalQuantity);
-      std::stringstream logStr;
-      logStr << "B, S, " << TOBPrice << ", " << TOBQuantity;
-      logVec.push_back(logStr.str());
-    }
+  std::size_t RejectedOrders() const { return rejectedOrders_; }
+
+  BookMemoryStats GetMemoryStats() const {
+    BookMemoryStats stats;
+    stats.orders         = {orderMap_.size(),
+                            HashMapBytes(orderMap_) + ListBytes<BookOrder_type>(orderMap_.size()),
+                            ordersHighWater_};
+    stats.buyLevels      = {buySide_.Size(), buySide_.Bytes(), buyLevelsHighWater_};
+    stats.sellLevels     = {sellSide_.Size(), sellSide_.Bytes(), sellLevelsHighWater_};
+    stats.rejectedOrders = rejectedOrders_;
+    return stats;
+  }
 
-    // Return if we have nothing left to do with this order, or if it is a market order.
-    if (order.quantity <= 0 || order.price == 0) {
-      return logVec;
-    }
+  // Prefetch hints for an order that is about to be handled, see BasicOrderBooks::HandleOrders().
+  // They only read the book, so an out of date hint costs a wasted prefetch, never a wrong result.
 
-    // MAKE THIS O(1) FOR EVERY ENTRY AFTER THE FIRST O(log n) ENTRY.
-    const auto inPriceMap = priceMap_.contains(order.price);
-    auto& limit           = (inPriceMap) ? *priceMap_[order.price] : buySide_[order.price];
-    if (!inPriceMap) {
-      priceMap_[order.price] = &limit;
+  // The level a new order would trade against first, and the level it would rest at.
+  template <Side S>
+  void PrefetchLevels(Price_type price) {
+    static constexpr auto otherSide = (S == Side::BUY) ? Side::SELL : Side::BUY;
+    __builtin_prefetch(Levels<otherSide>().Best(), 1);
+    if (price != 0) {
+      __builtin_prefetch(Levels<S>().Find(PriceTraits::FromWire(price)), 1);
     }
-    auto& list = limit.list;
-
-    limit.totalQuantity += order.quantity;
-    UpdateTOBBuySide();
-    if (order.price == TOBBuySide_->first) {
-      std::stringstream logStr;
-      logStr << "B, B, " << order.price << ", " << TOBBuySide_->second.totalQuantity;
-      logVec.push_back(logStr.str());
+  }
+
+  // The first resting order a new order would trade against. Its level should be in cache by now.
+  template <Side S>
+  void PrefetchOrders() {
+    static constexpr auto otherSide = (S == Side::BUY) ? Side::SELL : Side::BUY;
+    const auto* best                = Levels<otherSide>().Best();
+    if (best != nullptr && !best->list.empty()) {
+      __builtin_prefetch((S == Side::BUY) ? &best->list.front() : &best->list.back(), 1);
     }
-    const auto userOrderId = order.userOrderId;
-    list.push_back(std::move(order));
-    orderIdMap.insert_or_assign(userOrderId, OrderIt{&list, std::prev(list.end())});
-    return logVec;
   }
 
-  std::vector<std::string> SellOrder(Order order, OrderMap_type& orderIdMap) {
-    std::vector<std::string> logVec;
-    {
-      std::stringstream logStr;
-      logStr << "A, " << order.userId << ", " << order.userOrderId;
-      logVec.push_back(logStr.str());
+  // The resting order a cancel removes, and its level.
+  void PrefetchCancel(OrderId_type userOrderId) {
+    auto orderIt = orderMap_.find(userOrderId);
+    if (orderIt != orderMap_.end()) {
+      __builtin_prefetch(orderIt->second.limitPtr, 1);
+      __builtin_prefetch(&*orderIt->second.it, 1);
     }
-    // Check buy side.
+  }
+
+private:
+  template <Side S, typename OrderIdMap_T>
+  std::vector<Event> AddOrder(Order order, OrderIdMap_T& orderIdMap,
+                              typename OrderIdMap_T::mapped_type bookRef) {
+    static constexpr auto otherSide = (S == Side::BUY) ? Side::SELL : Side::BUY;
+    auto& sameSide                  = Levels<S>();
+    auto& oppositeSide              = Levels<otherSide>();
+
+    std::vector<Event> logVec;
+    logVec.push_back(Event::Ack(order.userId, order.userOrderId));
+
+    const auto isMarketOrder = (order.price == 0);
+    const auto price         = PriceTraits::FromWire(order.price);
+    auto quantity            = QuantityTraits::FromWire(order.quantity);
+
+    // Check the other side.
     bool updateTOB = false;
-    while (TOBBuySide_ != buySide_.rend() && order.quantity > 0) {
-      // We need to first check if the TOBBuySide >= our order.price (will still work if we are
-      // placing a market order)
-      const auto& buyPrice = TOBBuySide_->first;
-      if (buyPrice >= order.price) {
-        // We can trade.
-        const auto salePrice = (order.price == 0) ? buyPrice : std::min(buyPrice, order.price);
-        auto& buyLimit       = TOBBuySide_->second;
-        auto& buyList        = buyLimit.list;
-        auto it              = buyList.rbegin();
-        while (it != buyList.rend() && order.quantity > 0) {
-          auto& buyOrder = *it;
-          if (buyOrder.userId == order.userId) {
+    while (quantity > Quantity{}) {
+      auto* limit = oppositeSide.Best();
+      // A market order trades at any price. Otherwise a buy needs the best sell <= our price, and a
+      // sell needs the best buy >= our price.
+      if (limit == nullptr ||
+          !(isMarketOrder || ((S == Side::BUY) ? limit->price <= price : limit->price >= price))) {
+        break;
+      }
+      // We can trade.
+      updateTOB            = true;
+      // Buys trade at the resting sell's price, limit sells at their own price.
+      const auto salePrice = (S == Side::BUY || isMarketOrder)
+                                 ? PriceTraits::ToWire(limit->price)
+                                 : std::min<decltype(PriceTraits::ToWire(price))>(
+                                       PriceTraits::ToWire(limit->price), order.price);
+      auto& list           = limit->list;
+
+      auto trade = [&](const BookOrder_type& restingOrder, Quantity saleQuantity) {
+        const auto wireQuantity = QuantityTraits::ToWire(saleQuantity);
+        if constexpr (S == Side::BUY) {
+          logVec.push_back(Event::Trade(order.userId, order.userOrderId, restingOrder.userId,
+                                        restingOrder.userOrderId, salePrice, wireQuantity));
+        } else {
+          logVec.push_back(Event::Trade(restingOrder.userId, restingOrder.userOrderId,
+                                        order.userId, order.userOrderId, salePrice, wireQuantity));
+        }
+      };
+
+      // When we take the whole level, every other user's order at it fills in full. Those are left
+      // in the list as they fill and released together once the level is done, not one at a time.
+      const bool wholeLevel = (quantity >= limit->totalQuantity);
+
+      // Sells are matched against a buy level newest first, buys against a sell level oldest first.
+      // end() is re-read every time, rend() is invalidated by erasing the first order.
+      auto matchLevel = [&](auto begin, auto end, auto erase) {
+        auto it = begin;
+        while (it != end() && quantity > Quantity{}) {
+          auto& restingOrder = *it;
+          if (restingOrder.userId == order.userId) {
             // We can't trade with ourselves!
             ++it;
             continue;
           }
-          const auto saleQuantity = std::min(order.quantity, buyOrder.quantity);
-          {
-            std::stringstream logStr;
-            logStr << "T, " << buyOrder.userId << ", " << buyOrder.userOrderId << ", "
-                   << order.userId << ", " << order.userOrderId << ", " << salePrice << ", "
-                   << saleQuantity;
-            logVec.push_back(logStr.str());
-          }
-          buyLimit.totalQuantity -= saleQuantity;
-          order.quantity -= saleQuantity;
-          if (saleQuantity == buyOrder.quantity) {
-            orderIdMap.erase(buyOrder.userOrderId);
-            buyList.erase(std::next(it).base());
+          const auto saleQuantity = std::min(quantity, restingOrder.quantity);
+          trade(restingOrder, saleQuantity);
+          limit->totalQuantity -= saleQuantity;
+          quantity -= saleQuantity;
+          restingOrder.quantity -= saleQuantity;
+          if (restingOrder.quantity == Quantity{}) {
+            orderMap_.erase(restingOrder.userOrderId);
+            orderIdMap.erase(restingOrder.userOrderId);
+            it = wholeLevel ? std::next(it) : erase(it);
           }
         }
-        updateTOB = true;
+        return it == end();
+      };
 
-        // We have taken all of the TOB on buy side. Update.
-        if (it == buyList.rend()) {
-          UpdateTOBBuySide();
-        }
+      bool levelScanned = false;
+      if constexpr (S == Side::BUY) {
+        levelScanned = matchLevel(
+            list.begin(), [&] { return list.end(); }, [&](auto it) { return list.erase(it); });
       } else {
-        break;
+        levelScanned = matchLevel(
+            list.rbegin(), [&] { return list.rend(); },
+            [&](auto it) { return std::make_reverse_iterator(list.erase(std::next(it).base())); });
+      }
+
+      if (wholeLevel) {
+        if (limit->totalQuantity == Quantity{}) {
+          list.clear();
+        } else {
+          // Our own orders stay.
+          list.remove_if([](const BookOrder_type& restingOrder) {
+            return restingOrder.quantity == Quantity{};
+          });
+        }
+      }
+
+      // We have taken all of the TOB on the other side. Update.
+      if (levelScanned) {
+        if (limit->totalQuantity > Quantity{}) {
+          // Only our own orders are left at the TOB, we can't trade through them.
+          break;
+        }
+        oppositeSide.AdvanceBest();
       }
     }
 
     if (updateTOB) {
-      const auto isEliminated = (TOBBuySide_ == buySide_.rend());
-      std::string TOBPrice    = (isEliminated) ? "-" : std::to_string(TOBBuySide_->first);
-      std::string TOBQuantity =
-          (isEliminated) ? "-" : std::to_string(TOBBuySide_->second.totalQuantity);
-      std::stringstream logStr;
-      logStr << "B, B, " << TOBPrice << ", " << TOBQuantity;
-      logVec.push_back(logStr.str());
+      const auto* best = oppositeSide.Best();
+      logVec.push_back(Event::TopOfBook(
+          SideChar(otherSide), (best == nullptr) ? -1 : PriceTraits::ToWire(best->price),
+          (best == nullptr) ? -1 : QuantityTraits::ToWire(best->totalQuantity)));
     }
 
     // Return if we have nothing left to do with this order, or if it is a market order.
-    if (order.quantity <= 0 || order.price == 0) {
+    if (quantity <= Quantity{} || isMarketOrder) {
+      return logVec;
+    }
+
+    // A price the level container can't take, such as one too far from the rest of a ladder.
+    if (!sameSide.Fits(price)) {
+      logVec.push_back(
+          Event::Reject(order.userId, order.userOrderId, Event::RejectReason::PRICE_RANGE));
       return logVec;
     }
 
-    // MAKE THIS O(1) FOR EVERY ENTRY AFTER THE FIRST O(log n) ENTRY.
-    const auto inPriceMap = priceMap_.contains(order.price);
-    auto& limit           = (inPriceMap) ? *priceMap_[order.price] : sellSide_[order.price];
-    if (!inPriceMap) {
-      priceMap_[order.price] = &limit;
+    // Rather than let the book grow without bound, turn the remainder away. Levels are counted the
+    // way the container holds them, a ladder has one for every tick between its ends.
+    const auto levels = sameSide.SizeIfInserted(price);
+    if (orderMap_.size() >= limits_.maxRestingOrders ||
+        (levels > sameSide.Size() && levels > limits_.maxLevels)) {
+      ++rejectedOrders_;
+      logVec.push_back(
+          Event::Reject(order.userId, order.userOrderId, Event::RejectReason::BOOK_FULL));
+      return logVec;
     }
-    auto& list = limit.list;
-
-    limit.totalQuantity += order.quantity;
-    UpdateTOBSellSide();
-    if (order.price == TOBSellSide_->first) {
-      std::stringstream logStr;
-      logStr << "B, S, " << order.price << ", " << TOBSellSide_->second.totalQuantity;
-      logVec.push_back(logStr.str());
+
+    const auto& limit = RestOrder<S>(
+        price, BookOrder_type{order.userId, order.userOrderId, quantity}, orderIdMap, bookRef);
+    if (sameSide.Best() == &limit) {
+      logVec.push_back(Event::TopOfBook(SideChar(S), order.price,
+                                        QuantityTraits::ToWire(limit.totalQuantity)));
     }
-    const auto userOrderId = order.userOrderId;
-    list.push_back(std::move(order));
-    orderIdMap.insert_or_assign(userOrderId, OrderIt{&list, std::prev(list.end())});
     return logVec;
   }
+
+  // Puts the order at the back of its level's queue. Returns the level.
+  template <Side S, typename OrderIdMap_T>
+  Limit& RestOrder(Price price, const BookOrder_type& bookOrder, OrderIdMap_T& orderIdMap,
+                   typename OrderIdMap_T::mapped_type bookRef) {
+    auto& sameSide = Levels<S>();
+    // O(log n) or O(1) depending on the level container.
+    auto& limit    = sameSide.FindOrInsert(price);
+    auto& list     = limit.list;
+
+    limit.totalQuantity += bookOrder.quantity;
+    sameSide.Improve(limit);
+    list.push_back(bookOrder);
+    orderMap_.insert_or_assign(bookOrder.userOrderId, OrderIt{&limit, std::prev(list.end())});
+    orderIdMap.insert_or_assign(bookOrder.userOrderId, bookRef);
+    ordersHighWater_      = std::max(ordersHighWater_, orderMap_.size());
+    auto& levelsHighWater = (S == Side::BUY) ? buyLevelsHighWater_ : sellLevelsHighWater_;
+    levelsHighWater       = std::max(levelsHighWater, sameSide.Size());
+    return limit;
+  }
 };
 
-class OrderBooks {
+using OrderBook = BasicOrderBook<TreePolicy>;
+
+// All books, one per symbol. Each symbol's book uses one of Policies, the first one unless told
+// otherwise, so different symbols can use different level containers.
+template <typename... Policies>
+class BasicOrderBooks {
 public:
-  std::optional<std::vector<std::string>> HandleOrder(Order order) {
+  using Book_type      = std::variant<BasicOrderBook<Policies>...>;
+  using BookEntry_type = std::pair<const Symbol_type, Book_type>;
+
+  std::optional<std::vector<Event>> HandleOrder(Order order) {
     switch (order.orderType) {
-      case (Order::OrderType::BUY):
+      case (Order::OrderType::BUY): {
         maxOrderIdMap_[order.userId] = order.userOrderId;
-        return orderBooks_[order.symbol].BuyOrder(std::move(order), orderIdMap_);
+        auto& [symbol, book]         = GetBook(order.symbol);
+        auto events                  = std::visit(
+            [&](auto& b) { return b.BuyOrder(std::move(order), orderIdMap_, &book); }, book);
+        analytics_.Record(symbol, events);
+        UpdateHighWater();
+        return events;
         break;
-      case (Order::OrderType::SELL):
+      }
+      case (Order::OrderType::SELL): {
         maxOrderIdMap_[order.userId] = order.userOrderId;
-        return orderBooks_[order.symbol].SellOrder(std::move(order), orderIdMap_);
+        auto& [symbol, book]         = GetBook(order.symbol);
+        auto events                  = std::visit(
+            [&](auto& b) { return b.SellOrder(std::move(order), orderIdMap_, &book); }, book);
+        analytics_.Record(symbol, events);
+        UpdateHighWater();
+        return events;
         break;
+      }
       case (Order::OrderType::CANCEL):
         return CancelOrder(std::move(order));
         break;
       case (Order::OrderType::FLUSH):
-        orderBooks_.clear();
-        orderIdMap_.clear();
-        maxOrderIdMap_.clear();
+        Reset();
         return std::nullopt;
         break;
       default:
@@ -302,38 +625,240 @@ public:
     }
   }
 
+  // Same as calling HandleOrder() on each order in turn, with onResult(index, result) called after
+  // each one. Meanwhile the memory that the next orders will touch is prefetched in stages, each
+  // ORDER_PREFETCH_DISTANCE orders ahead of the next: first the book, then its levels, then the
+  // resting orders. So the cache misses of one order overlap with the matching of those before it
+  // instead of stalling it. Only the book lookup is kept between stages, everything else is looked
+  // up again when the order is handled, so the results are exactly those of sequential processing.
+  template <typename F>
+  void HandleOrders(std::span<Order> orders, F&& onResult) {
+    static constexpr auto distance  = static_cast<std::ptrdiff_t>(ORDER_PREFETCH_DISTANCE);
+    static constexpr auto numStages = static_cast<std::ptrdiff_t>(PrefetchStage::NUM_STAGES);
+    const auto numOrders            = static_cast<std::ptrdiff_t>(orders.size());
+    prefetchBooks_.assign(orders.size(), nullptr);
+    for (auto i = -distance * numStages; i < numOrders; ++i) {
+      for (std::ptrdiff_t stage = 0; stage < numStages; ++stage) {
+        const auto ahead = i + (numStages - stage) * distance;
+        if (ahead >= 0 && ahead < numOrders) {
+          Prefetch(orders[ahead], prefetchBooks_[ahead], static_cast<PrefetchStage>(stage));
+        }
+      }
+      if (i >= 0) {
+        const auto isFlush = (orders[i].orderType == Order::OrderType::FLUSH);
+        onResult(static_cast<std::size_t>(i), HandleOrder(std::move(orders[i])));
+        if (isFlush) {
+          // The books are gone, so are the ones looked up for the orders ahead.
+          std::fill(prefetchBooks_.begin() + i, prefetchBooks_.end(), nullptr);
+        }
+      }
+    }
+  }
+
   void Reset() {
+    for (const auto& [_, book] : orderBooks_) {
+      flushedRejects_ += std::visit([](const auto& b) { return b.RejectedOrders(); }, book);
+    }
     orderBooks_.clear();
     orderIdMap_.clear();
     maxOrderIdMap_.clear();
+    analytics_.Reset();
+  }
+
+  // See OrderBooksSnapshot.
+  OrderBooksSnapshot Snapshot() {
+    OrderBooksSnapshot snapshot;
+    for (auto& [symbol, book] : orderBooks_) {
+      auto& bookSnapshot  = snapshot.books.emplace_back();
+      bookSnapshot.symbol = symbol;
+      bookSnapshot.policy = book.index();
+      std::visit([&](auto& b) { b.Snapshot(bookSnapshot.orders); }, book);
+    }
+    for (const auto& [userId, userOrderId] : maxOrderIdMap_) {
+      snapshot.maxOrderIds.push_back({userId, userOrderId});
+    }
+    return snapshot;
+  }
+
+  // Replaces the books with those of a Snapshot(), as a FLUSH followed by their orders would
+  // without the matching.
+  void LoadSnapshot(const OrderBooksSnapshot& snapshot) {
+    Reset();
+    for (const auto& bookSnapshot : snapshot.books) {
+      if (bookSnapshot.policy >= sizeof...(Policies) ||
+          orderBooks_.contains(bookSnapshot.symbol)) {
+        throw std::runtime_error("Invalid book in OrderBooks snapshot.");
+      }
+      auto& [symbol, book] = EmplaceBook(bookSnapshot.symbol, bookSnapshot.policy,
+                                         std::index_sequence_for<Policies...>{});
+      std::visit([&](auto& b) { b.Restore(bookSnapshot.orders, orderIdMap_, &book); }, book);
+    }
+    for (const auto& [userId, userOrderId] : snapshot.maxOrderIds) {
+      maxOrderIdMap_[userId] = userOrderId;
+    }
+    UpdateHighWater();
+  }
+
+  // Applies to every book, present and future.
+  void SetBookLimits(const BookLimits& limits) {
+    bookLimits_ = limits;
+    for (auto& [_, book] : orderBooks_) {
+      std::visit([&](auto& b) { b.SetLimits(bookLimits_); }, book);
+    }
+  }
+
+  // Matching thread only, it walks every book.
+  MemoryStats GetMemoryStats() const {
+    MemoryStats stats;
+    stats.orderBooks     = {orderBooks_.size(), HashMapBytes(orderBooks_), orderBooksHighWater_};
+    stats.orderIdMap     = {orderIdMap_.size(), HashMapBytes(orderIdMap_), orderIdMapHighWater_};
+    stats.maxOrderIdMap  = {maxOrderIdMap_.size(), HashMapBytes(maxOrderIdMap_),
+                            maxOrderIdMapHighWater_};
+    stats.rejectedOrders = flushedRejects_;
+    for (const auto& [symbol, book] : orderBooks_) {
+      stats.books.push_back(std::visit([](const auto& b) { return b.GetMemoryStats(); }, book));
+      stats.books.back().symbol = symbol;
+      stats.rejectedOrders += stats.books.back().rejectedOrders;
+    }
+    return stats;
+  }
+
+  // Readable from any thread while this one matches, see trade_analytics.h.
+  const TradeAnalytics& GetTradeAnalytics() const { return analytics_; }
+
+  // Policy for symbols without one of their own. Applies to books created from now on.
+  template <typename Policy>
+  void SetDefaultPolicy() {
+    defaultPolicy_ = PolicyIndex<Policy>();
+  }
+
+  template <typename Policy>
+  void SetSymbolPolicy(const Symbol_type& symbol) {
+    symbolPolicies_.insert_or_assign(symbol, PolicyIndex<Policy>());
   }
 
 private:
-  std::vector<std::string> CancelOrder(Order order) {
-    const auto maxUserOrderId = ++maxOrderIdMap_[order.userId];
-    std::vector<std::string> logVec;
-    {
-      std::stringstream logStrC;
-      logStrC << "C, " << order.userId << ", " << order.userOrderId << ", " << maxUserOrderId;
-      logVec.push_back(logStrC.str());
-      std::stringstream logStrA;
-      logStrA << "A, " << order.userId << ", " << maxUserOrderId;
-      logVec.push_back(logStrA.str());
+  enum class PrefetchStage { BOOK, LEVELS, ORDERS, NUM_STAGES };
+
+  // One stage of HandleOrders()' prefetching for one order. book is where the BOOK stage leaves the
+  // order's book for the later stages, nullptr if it didn't have one yet.
+  void Prefetch(const Order& order, Book_type*& book, PrefetchStage stage) {
+    const auto isBuy = (order.orderType == Order::OrderType::BUY);
+    switch (order.orderType) {
+      case (Order::OrderType::BUY):
+      case (Order::OrderType::SELL): {
+        if (stage == PrefetchStage::BOOK) {
+          auto it = orderBooks_.find(order.symbol);
+          book    = (it == orderBooks_.end()) ? nullptr : &it->second;
+          __builtin_prefetch(book);
+        } else if (book != nullptr) {
+          std::visit(
+              [&](auto& b) {
+                if (stage == PrefetchStage::LEVELS && isBuy) {
+                  b.template PrefetchLevels<Side::BUY>(order.price);
+                } else if (stage == PrefetchStage::LEVELS) {
+                  b.template PrefetchLevels<Side::SELL>(order.price);
+                } else if (isBuy) {
+                  b.template PrefetchOrders<Side::BUY>();
+                } else {
+                  b.template PrefetchOrders<Side::SELL>();
+                }
+              },
+              *book);
+        }
+        break;
+      }
+      case (Order::OrderType::CANCEL): {
+        if (stage == PrefetchStage::BOOK) {
+          auto it = orderIdMap_.find(order.userOrderId);
+          book    = (it == orderIdMap_.end()) ? nullptr : it->second;
+          __builtin_prefetch(book);
+        } else if (stage == PrefetchStage::LEVELS && book != nullptr) {
+          std::visit([&](auto& b) { b.PrefetchCancel(order.userOrderId); }, *book);
+        }
+        break;
+      }
+      default:
+        break;
     }
-    if (!orderIdMap_.contains(order.userOrderId)) {
+  }
+
+  void UpdateHighWater() {
+    orderBooksHighWater_    = std::max(orderBooksHighWater_, orderBooks_.size());
+    orderIdMapHighWater_    = std::max(orderIdMapHighWater_, orderIdMap_.size());
+    maxOrderIdMapHighWater_ = std::max(maxOrderIdMapHighWater_, maxOrderIdMap_.size());
+  }
+
+  template <typename Policy>
+  static constexpr std::size_t PolicyIndex() {
+    constexpr bool matches[] = {std::is_same_v<Policy, Policies>...};
+    for (std::size_t i = 0; i < sizeof...(Policies); ++i) {
+      if (matches[i]) {
+        return i;
+      }
+    }
+    throw std::logic_error("Policy is not one of the OrderBooks policies");
+  }
+
+  // The book's entry, so that its symbol outlives the order's.
+  BookEntry_type& GetBook(const Symbol_type& symbol) {
+    auto it = orderBooks_.find(symbol);
+    if (it != orderBooks_.end()) {
+      return *it;
+    }
+    auto policyIt     = symbolPolicies_.find(symbol);
+    const auto policy = (policyIt == symbolPolicies_.end()) ? defaultPolicy_ : policyIt->second;
+    return EmplaceBook(symbol, policy, std::index_sequence_for<Policies...>{});
+  }
+
+  // Books can't be moved, so each one is built in place as the policy's alternative.
+  template <std::size_t... I>
+  BookEntry_type& EmplaceBook(const Symbol_type& symbol, std::size_t policy,
+                              std::index_sequence<I...>) {
+    BookEntry_type* entry = nullptr;
+    ((policy == I ? (void)(entry = &*orderBooks_
+                                         .emplace(std::piecewise_construct,
+                                                  std::forward_as_tuple(symbol),
+                                                  std::forward_as_tuple(std::in_place_index<I>))
+                                         .first)
+                  : void()),
+     ...);
+    std::visit([&](auto& b) { b.SetLimits(bookLimits_); }, entry->second);
+    return *entry;
+  }
+
+  std::vector<Event> CancelOrder(Order order) {
+    const auto maxUserOrderId = ++maxOrderIdMap_[order.userId];
+    std::vector<Event> logVec;
+    logVec.push_back(Event::Cancel(order.userId, order.userOrderId, maxUserOrderId));
+    logVec.push_back(Event::Ack(order.userId, maxUserOrderId));
+    auto orderIt = orderIdMap_.find(order.userOrderId);
+    if (orderIt == orderIdMap_.end()) {
       return logVec;
     }
     // O(1)
-    auto& orderIt = orderIdMap_.at(order.userOrderId);
-    auto _        = orderIt.listPtr->erase(orderIt.it);
-    orderIdMap_.erase(order.userOrderId);
+    auto* book = orderIt->second;
+    orderIdMap_.erase(orderIt);
+    std::visit([&](auto& b) { b.CancelOrder(order.userOrderId); }, *book);
     return logVec;
   }
 
-  std::unordered_map<Symbol_type, OrderBook> orderBooks_;
-  OrderBook::OrderMap_type orderIdMap_;
+  std::unordered_map<Symbol_type, Book_type> orderBooks_;
+  std::unordered_map<OrderId_type, Book_type*> orderIdMap_;  // Which book each order rests in.
   std::unordered_map<UserId_type, int>
       maxOrderIdMap_;  // Because cancel operations don't possess an order Id.
+  std::unordered_map<Symbol_type, std::size_t> symbolPolicies_;
+  std::size_t defaultPolicy_ = 0;
+  std::vector<Book_type*> prefetchBooks_;  // HandleOrders()' book lookups, one per order.
+  TradeAnalytics analytics_;
+  BookLimits bookLimits_;
+  std::size_t orderBooksHighWater_    = 0;
+  std::size_t orderIdMapHighWater_    = 0;
+  std::size_t maxOrderIdMapHighWater_ = 0;
+  std::size_t flushedRejects_         = 0;  // Of the books since cleared by a FLUSH.
 };
 
+using OrderBooks = BasicOrderBooks<TreePolicy, FlatPolicy, LadderPolicy, PooledTreePolicy,
+                                   PooledLadderPolicy, FixedPointTreePolicy>;
+
 #endif  // #ifndef ORDER_BOOK_H
@@ -0,0 +1,186 @@
+#ifndef REFERENCE_ORDER_BOOK_H
+#define REFERENCE_ORDER_BOOK_H
+
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "order_book.h"
+
+// A deliberately naive matcher with the same behaviour as OrderBooks, to check it against (see
+// differential_fuzzer.h). Each side of a book is one vector of resting orders in arrival order,
+// and every question (best price, quantity at a price, who trades next) is answered by scanning
+// it. Nothing is cached, so there is no index or top of book to get out of date. Far too slow
+// for real use, books are expected to stay small.
+//
+// The rules it implements:
+// * Every BUY or SELL is acknowledged first.
+// * A new order trades against the best opposite price while it crosses, a market order (price 0)
+//   at any price. At a price, buys take resting sells oldest first, sells take resting buys newest
+//   first. A user's orders never trade with each other, and if only the user's own orders are left
+//   at the best price, matching stops there.
+// * Buys and market sells trade at the resting price, limit sells at their own price.
+// * If the order reached the opposite side, that side's top of book follows its trades.
+// * What is left of a limit order rests, with a top of book event if it rests at the best price.
+//   What is left of a market order is dropped.
+// * A CANCEL is confirmed with the next order id of its user, whether or not the order still
+//   rests, and never produces a top of book event.
+// * FLUSH empties everything and produces no events.
+class ReferenceOrderBooks {
+public:
+  std::optional<std::vector<Event>> HandleOrder(const Order& order) {
+    switch (order.orderType) {
+      case (Order::OrderType::BUY):
+      case (Order::OrderType::SELL):
+        lastOrderIds_[order.userId] = order.userOrderId;
+        return AddOrder(order);
+      case (Order::OrderType::CANCEL):
+        return CancelOrder(order);
+      case (Order::OrderType::FLUSH):
+        books_.clear();
+        lastOrderIds_.clear();
+        return std::nullopt;
+      default:
+        throw std::runtime_error("Invalid Order::OrderType in ReferenceOrderBooks::HandleOrder");
+    }
+  }
+
+private:
+  struct Resting {
+    UserId_type userId;
+    UserOrderId_type userOrderId;
+    Price_type price;
+    Quantity_type quantity;
+  };
+
+  using Side_type = std::vector<Resting>;  // In arrival order.
+
+  struct Book {
+    Side_type buys;
+    Side_type sells;
+  };
+
+  static bool Better(Side side, Price_type a, Price_type b) {
+    return (side == Side::BUY) ? a > b : a < b;
+  }
+
+  static std::optional<Price_type> BestPrice(const Side_type& orders, Side side) {
+    std::optional<Price_type> best;
+    for (const auto& resting : orders) {
+      if (!best || Better(side, resting.price, *best)) {
+        best = resting.price;
+      }
+    }
+    return best;
+  }
+
+  static Quantity_type QuantityAt(const Side_type& orders, Price_type price) {
+    Quantity_type quantity = 0;
+    for (const auto& resting : orders) {
+      if (resting.price == price) {
+        quantity += resting.quantity;
+      }
+    }
+    return quantity;
+  }
+
+  static Event TopOfBook(const Side_type& orders, Side side) {
+    const char sideChar = (side == Side::BUY) ? 'B' : 'S';
+    const auto best     = BestPrice(orders, side);
+    return (best) ? Event::TopOfBook(sideChar, *best, QuantityAt(orders, *best))
+                  : Event::TopOfBook(sideChar, -1, -1);
+  }
+
+  std::vector<Event> AddOrder(const Order& order) {
+    const auto side      = (order.orderType == Order::OrderType::BUY) ? Side::BUY : Side::SELL;
+    const auto otherSide = (side == Side::BUY) ? Side::SELL : Side::BUY;
+    auto& book           = books_[order.symbol];
+    auto& sameOrders     = (side == Side::BUY) ? book.buys : book.sells;
+    auto& otherOrders    = (side == Side::BUY) ? book.sells : book.buys;
+    const auto isMarket  = (order.price == 0);
+    auto quantity        = order.quantity;
+
+    std::vector<Event> events{Event::Ack(order.userId, order.userOrderId)};
+    bool reachedOtherSide = false;
+    while (quantity > 0) {
+      const auto best = BestPrice(otherOrders, otherSide);
+      const auto crosses =
+          best && (isMarket || ((side == Side::BUY) ? *best <= order.price : *best >= order.price));
+      if (!crosses) {
+        break;
+      }
+      reachedOtherSide     = true;
+      const auto salePrice = (side == Side::SELL && !isMarket) ? order.price : *best;
+
+      // The resting orders at this price, in the order they trade.
+      std::vector<std::size_t> queue;
+      for (std::size_t i = 0; i < otherOrders.size(); ++i) {
+        if (otherOrders[i].price == *best) {
+          queue.push_back(i);
+        }
+      }
+      if (side == Side::SELL) {
+        std::reverse(queue.begin(), queue.end());
+      }
+      for (const auto i : queue) {
+        auto& resting = otherOrders[i];
+        if (quantity == 0 || resting.userId == order.userId) {
+          continue;
+        }
+        const auto saleQuantity = std::min(quantity, resting.quantity);
+        if (side == Side::BUY) {
+          events.push_back(Event::Trade(order.userId, order.userOrderId, resting.userId,
+                                        resting.userOrderId, salePrice, saleQuantity));
+        } else {
+          events.push_back(Event::Trade(resting.userId, resting.userOrderId, order.userId,
+                                        order.userOrderId, salePrice, saleQuantity));
+        }
+        quantity -= saleQuantity;
+        resting.quantity -= saleQuantity;
+      }
+      std::erase_if(otherOrders, [](const Resting& resting) { return resting.quantity == 0; });
+
+      // Either the order is filled, or only its own user's orders are left at this price.
+      if (QuantityAt(otherOrders, *best) > 0) {
+        break;
+      }
+    }
+    if (reachedOtherSide) {
+      events.push_back(TopOfBook(otherOrders, otherSide));
+    }
+
+    if (quantity > 0 && !isMarket) {
+      sameOrders.push_back({order.userId, order.userOrderId, order.price, quantity});
+      if (BestPrice(sameOrders, side) == order.price) {
+        events.push_back(TopOfBook(sameOrders, side));
+      }
+    }
+    return events;
+  }
+
+  std::vector<Event> CancelOrder(const Order& order) {
+    const auto ackUserOrderId = ++lastOrderIds_[order.userId];
+    for (auto& [symbol, book] : books_) {
+      for (auto* orders : {&book.buys, &book.sells}) {
+        std::erase_if(*orders, [&](const Resting& resting) {
+          return resting.userOrderId == order.userOrderId;
+        });
+      }
+    }
+    return {Event::Cancel(order.userId, order.userOrderId, ackUserOrderId),
+            Event::Ack(order.userId, ackUserOrderId)};
+  }
+
+  std::map<Symbol_type, Book> books_;
+  std::unordered_map<UserId_type, UserOrderId_type> lastOrderIds_;
+};
+
+#endif  // #ifndef REFERENCE_ORDER_BOOK_H
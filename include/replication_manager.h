@@ -0,0 +1,406 @@
+#ifndef REPLICATION_MANAGER_H
+#define REPLICATION_MANAGER_H
+
+/////////////////
+/// std
+/////////////////
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "memory_stats.h"
+#include "order_book.h"
+#include "serialization.h"
+#include "socket_wrappers.h"
+#include "spsc_queue.h"
+
+// One datagram of the replication protocol. The primary numbers every order it applies to its books
+// 1, 2, 3, ... and sends them to the standby in that order. The standby asks for whatever it
+// misses, and for a snapshot of the primary's books once that is more than the primary still has.
+struct ReplicationMessage {
+  enum class MessageType : char {
+    ORDERS,     // Primary -> standby: orders firstSequence, firstSequence + 1, ...
+    HEARTBEAT,  // Primary -> standby: still alive, lastSequence is the last order sent.
+    SHUTDOWN,   // Primary -> standby: stopping cleanly, don't take over.
+    RESEND,     // Standby -> primary: please send orders firstSequence to lastSequence again.
+    TOO_OLD,    // Primary -> standby: orders before firstSequence can't be resent any more.
+    // Standby -> primary: please send the snapshot taken after order lastSequence from byte
+    // firstSequence on, or a new one if lastSequence is 0 or that one is no use any more.
+    SNAPSHOT_REQUEST,
+    // Primary -> standby: bytes firstSequence on of the serialized OrderBooksSnapshot taken after
+    // order lastSequence, snapshotBytes long in all.
+    SNAPSHOT
+  } messageType;
+
+  std::uint64_t firstSequence = 0;
+  std::uint64_t lastSequence  = 0;
+  std::vector<Order> orders;
+  std::uint64_t snapshotBytes = 0;
+  std::string snapshot;
+
+  template <typename Archive>
+  void serialize(Archive& archive) {
+    archive& messageType& firstSequence& lastSequence& orders& snapshotBytes& snapshot;
+  }
+};
+
+struct ReplicationStats {
+  std::uint64_t sentOrders     = 0;
+  std::uint64_t resentOrders   = 0;
+  std::uint64_t resendRequests = 0;
+  std::uint64_t tooOldRequests = 0;  // Resend requests for orders no longer kept.
+  std::uint64_t droppedOrders  = 0;  // Found the queue full, the standby needs a snapshot.
+  std::uint64_t snapshots      = 0;  // Snapshots of the books taken for the standby.
+};
+
+// Primary side of replication. The matching thread numbers every order it is about to apply and
+// pushes it into a lock-free queue, and a separate thread sends them to the standby, keeps them for
+// resends and sends heartbeats. Nothing on the matching thread waits on the network, or on this
+// thread: an order that finds the queue full is dropped, which leaves a gap in the numbering that
+// the standby can't have resent, so it catches up from a snapshot as below.
+//
+// Orders are kept for resending back to the last FLUSH: a FLUSH resets every book, so a standby that
+// has missed something before one can skip straight to it (see StandbyManager). Only the last
+// resendWindow of them are kept though, in a ring. A standby asking for anything older is told
+// TOO_OLD, and asks for a snapshot of the books instead: the matching thread serializes its books
+// between two batches (SnapshotWanted, PushSnapshot), this thread sends that in chunks, and the
+// standby carries on from the orders after it. The last snapshot is kept for as long as the orders
+// after it are, so a standby that lost part of it can ask for the rest.
+template <std::size_t QueueCapacity>
+class BasicReplicationManager {
+public:
+  BasicReplicationManager(const std::string& standbyHost,
+                          const std::string& port  = REPLICATION_PORT,
+                          std::size_t resendWindow = REPLICATION_RESEND_WINDOW)
+      : queue_(std::make_unique<Queue_type>()), resendWindow_(resendWindow) {
+    if (resendWindow_ == 0) {
+      throw std::runtime_error("ReplicationManager needs a resend window of at least one order.");
+    }
+    SetAddrInfo(&addrInfo_, standbyHost.c_str(), port.c_str());
+    SetSocket(addrInfo_, fd_);
+    thread_ = std::jthread(&BasicReplicationManager::Run, this);
+  }
+
+  ~BasicReplicationManager() {
+    Stop();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    freeaddrinfo(addrInfo_);
+    close(fd_);
+  }
+
+  BasicReplicationManager(const BasicReplicationManager&) = delete;
+  void operator=(const BasicReplicationManager&)          = delete;
+
+  // Called by the matching thread, in the order the orders are applied. Never waits. The queue
+  // holds QueueCapacity orders, it only fills if sending falls behind matching for that long. An
+  // order dropped then is counted, and a snapshot is asked for at the end of the batch.
+  void Push(const Order& order) {
+    if (!queue_->TryPush({.sequence = ++pushed_, .order = order})) {
+      droppedOrders_.fetch_add(1, std::memory_order_relaxed);
+      snapshotWanted_.store(true, std::memory_order_release);
+    }
+  }
+
+  // Called by the matching thread between batches. The standby needs a snapshot of the books.
+  bool SnapshotWanted() const { return snapshotWanted_.load(std::memory_order_acquire); }
+
+  // Called by the matching thread, with its books serialized after every order pushed so far (see
+  // OrderBooks::Snapshot).
+  void PushSnapshot(std::string&& snapshot) {
+    std::lock_guard lock(snapshotMutex_);
+    newSnapshot_ = {.sequence = pushed_, .bytes = std::move(snapshot)};
+    snapshotWanted_.store(false, std::memory_order_release);
+    snapshotReady_.store(true, std::memory_order_release);
+  }
+
+  // Sends everything still queued, then tells the standby we are stopping.
+  void Stop() { stopFlag_ = true; }
+
+  ReplicationStats GetStats() const {
+    return {sentOrders_.load(std::memory_order_relaxed),
+            resentOrders_.load(std::memory_order_relaxed),
+            resendRequests_.load(std::memory_order_relaxed),
+            tooOldRequests_.load(std::memory_order_relaxed),
+            droppedOrders_.load(std::memory_order_relaxed),
+            snapshots_.load(std::memory_order_relaxed)};
+  }
+
+  // Any thread. The orders kept for resends.
+  StructureMemory GetLogMemory() const {
+    return {logOrders_.load(std::memory_order_relaxed), logBytes_.load(std::memory_order_relaxed),
+            logHighWater_.load(std::memory_order_relaxed)};
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct SequencedOrder {
+    std::uint64_t sequence = 0;
+    Order order;
+  };
+
+  using Queue_type = SPSCQueue<SequencedOrder, QueueCapacity>;
+
+  struct Snapshot {
+    std::uint64_t sequence = 0;  // Taken after this order.
+    std::string bytes;
+  };
+
+  void Run() {
+    ReplicationMessage outgoing{.messageType   = ReplicationMessage::MessageType::ORDERS,
+                                .firstSequence = 0,
+                                .lastSequence  = 0,
+                                .orders        = {},
+                                .snapshotBytes = 0,
+                                .snapshot      = {}};
+    auto lastSend = Clock::now();
+    IdleBackoff backoff;
+    while (true) {
+      const auto stopping = stopFlag_.load();
+      const auto count    = queue_->ConsumeBatch(
+          [&](SequencedOrder&& sequenced) {
+            const auto sequence = sequenced.sequence;
+            auto& order         = sequenced.order;
+            if (order.orderType == Order::OrderType::FLUSH) {
+              // Nothing before a FLUSH is needed to rebuild the books.
+              logStart_      = sequence;
+              resetSequence_ = sequence;
+            } else if (sequence != lastSequence_ + 1) {
+              // The orders in between were dropped, nothing before them can be resent either.
+              logStart_ = sequence;
+            } else if (sequence - logStart_ == resendWindow_) {
+              ++logStart_;  // The ring is full, the oldest order makes room.
+            }
+            lastSequence_   = sequence;
+            const auto slot = sequence % resendWindow_;
+            if (slot >= log_.size()) {
+              log_.resize(slot + 1);
+            }
+            log_[slot] = order;
+            if (!outgoing.orders.empty() &&
+                outgoing.firstSequence + outgoing.orders.size() != sequence) {
+              sentOrders_.fetch_add(outgoing.orders.size(), std::memory_order_relaxed);
+              SendOrders(outgoing);
+            }
+            if (outgoing.orders.empty()) {
+              outgoing.firstSequence = sequence;
+            }
+            outgoing.orders.push_back(std::move(order));
+            if (outgoing.orders.size() == REPLICATION_BATCH_SIZE) {
+              sentOrders_.fetch_add(outgoing.orders.size(), std::memory_order_relaxed);
+              SendOrders(outgoing);
+            }
+          },
+          QueueCapacity);
+      if (!outgoing.orders.empty()) {
+        sentOrders_.fetch_add(outgoing.orders.size(), std::memory_order_relaxed);
+        SendOrders(outgoing);
+      }
+      if (count > 0) {
+        lastSend = Clock::now();
+        UpdateLogMemory();
+        backoff.Reset();
+      }
+      if (snapshotReady_.load(std::memory_order_acquire)) {
+        TakeSnapshot();
+      }
+
+      HandleRequests();
+
+      if (count == 0) {
+        if (stopping) {
+          // Best effort, if every copy is lost the standby takes over and idles out.
+          for (int i = 0; i < 3; ++i) {
+            Send({.messageType   = ReplicationMessage::MessageType::SHUTDOWN,
+                  .firstSequence = 0,
+                  .lastSequence  = lastSequence_,
+                  .orders        = {},
+                  .snapshotBytes = 0,
+                  .snapshot      = {}});
+          }
+          break;
+        }
+        const auto now = Clock::now();
+        if (now - lastSend >= std::chrono::milliseconds(REPLICATION_HEARTBEAT_MS)) {
+          Send({.messageType   = ReplicationMessage::MessageType::HEARTBEAT,
+                .firstSequence = 0,
+                .lastSequence  = lastSequence_,
+                .orders        = {},
+                .snapshotBytes = 0,
+                .snapshot      = {}});
+          lastSend = now;
+        }
+        backoff.Wait();
+      }
+    }
+  }
+
+  void SendOrders(ReplicationMessage& message) {
+    message.lastSequence = message.firstSequence + message.orders.size() - 1;
+    Send(message);
+    message.orders.clear();
+  }
+
+  void Send(const ReplicationMessage& message) {
+    const auto serializedMessage = SerializeObject(message);
+    // A standby that isn't up yet must not take the primary down, it asks for what it missed.
+    sendto(fd_, serializedMessage.data(), serializedMessage.size(), 0, addrInfo_->ai_addr,
+           addrInfo_->ai_addrlen);
+  }
+
+  // Answers the standby's resend requests, without blocking.
+  void HandleRequests() {
+    while (true) {
+      const auto readStatus = recv(fd_, buffer_.data(), buffer_.size(), MSG_DONTWAIT);
+      if (readStatus < 0) {
+        return;
+      }
+      ReplicationMessage request;
+      try {
+        DeserializeObject(request, buffer_.data(), readStatus);
+      } catch (const std::exception&) {
+        continue;
+      }
+      if (request.messageType == ReplicationMessage::MessageType::SNAPSHOT_REQUEST) {
+        HandleSnapshotRequest(request);
+        continue;
+      }
+      if (request.messageType != ReplicationMessage::MessageType::RESEND) {
+        continue;
+      }
+      resendRequests_.fetch_add(1, std::memory_order_relaxed);
+      // Anything older than resetSequence_ was wiped out by the FLUSH there, anything else older
+      // than logStart_ has left the ring.
+      auto first = std::max(request.firstSequence, resetSequence_);
+      if (first < logStart_) {
+        tooOldRequests_.fetch_add(1, std::memory_order_relaxed);
+        Send({.messageType   = ReplicationMessage::MessageType::TOO_OLD,
+              .firstSequence = logStart_,
+              .lastSequence  = lastSequence_,
+              .orders        = {},
+              .snapshotBytes = 0,
+              .snapshot      = {}});
+        first = logStart_;
+      }
+      const auto last = std::min(request.lastSequence, lastSequence_);
+      ReplicationMessage resend{.messageType   = ReplicationMessage::MessageType::ORDERS,
+                                .firstSequence = 0,
+                                .lastSequence  = 0,
+                                .orders        = {},
+                                .snapshotBytes = 0,
+                                .snapshot      = {}};
+      for (auto sequence = first; sequence <= last; ++sequence) {
+        if (resend.orders.empty()) {
+          resend.firstSequence = sequence;
+        }
+        resend.orders.push_back(log_[sequence % resendWindow_]);
+        if (resend.orders.size() == REPLICATION_BATCH_SIZE || sequence == last) {
+          resentOrders_.fetch_add(resend.orders.size(), std::memory_order_relaxed);
+          SendOrders(resend);
+        }
+      }
+    }
+  }
+
+  // Takes the snapshot over from the matching thread once every order it pushed before it is
+  // numbered here. If the queue runs dry first, the rest were dropped.
+  void TakeSnapshot() {
+    std::lock_guard lock(snapshotMutex_);
+    if (lastSequence_ < newSnapshot_.sequence) {
+      if (!queue_->Empty()) {
+        return;
+      }
+      lastSequence_ = newSnapshot_.sequence;
+      logStart_     = lastSequence_ + 1;
+    }
+    snapshot_ = std::move(newSnapshot_);
+    snapshotReady_.store(false, std::memory_order_relaxed);
+    snapshots_.fetch_add(1, std::memory_order_relaxed);
+    SendSnapshot(0);
+  }
+
+  // Sends the rest of the snapshot the standby is putting together, or has the matching thread
+  // take a new one. A snapshot is only of use while the orders after it can still be resent.
+  void HandleSnapshotRequest(const ReplicationMessage& request) {
+    const auto current =
+        snapshot_.has_value() && std::max(snapshot_->sequence + 1, resetSequence_) >= logStart_;
+    if (current && request.lastSequence == snapshot_->sequence) {
+      SendSnapshot(request.firstSequence);
+    } else if (current && request.lastSequence == 0) {
+      SendSnapshot(0);
+    } else if (!snapshotReady_.load(std::memory_order_acquire)) {
+      snapshotWanted_.store(true, std::memory_order_release);
+    }
+  }
+
+  // REPLICATION_SNAPSHOT_WINDOW chunks from offset on, the standby asks for the next ones once they
+  // are in. Sending all of a large snapshot at once would overrun its receive buffer.
+  void SendSnapshot(std::uint64_t offset) {
+    const auto& bytes = snapshot_->bytes;
+    for (std::size_t i = 0; i < REPLICATION_SNAPSHOT_WINDOW && offset < bytes.size(); ++i) {
+      Send({.messageType   = ReplicationMessage::MessageType::SNAPSHOT,
+            .firstSequence = offset,
+            .lastSequence  = snapshot_->sequence,
+            .orders        = {},
+            .snapshotBytes = bytes.size(),
+            .snapshot      = bytes.substr(offset, REPLICATION_SNAPSHOT_CHUNK)});
+      offset += REPLICATION_SNAPSHOT_CHUNK;
+    }
+  }
+
+  void UpdateLogMemory() {
+    const auto logOrders = lastSequence_ + 1 - logStart_;
+    logOrders_.store(logOrders, std::memory_order_relaxed);
+    logBytes_.store(VectorBytes(log_), std::memory_order_relaxed);
+    logHighWater_.store(std::max(logHighWater_.load(std::memory_order_relaxed), logOrders),
+                        std::memory_order_relaxed);
+  }
+
+  addrinfo* addrInfo_ = nullptr;
+  int fd_             = -1;
+  std::unique_ptr<Queue_type> queue_;
+  std::size_t resendWindow_;
+  std::vector<Order> log_;  // Ring of orders logStart_ to lastSequence_, at sequence % size.
+  std::uint64_t logStart_      = 1;
+  std::uint64_t resetSequence_ = 1;  // The last FLUSH, nothing before it is ever resent.
+  std::uint64_t lastSequence_  = 0;
+  std::uint64_t pushed_        = 0;  // Matching thread, the sequence of the last order numbered.
+  std::optional<Snapshot> snapshot_;  // The last one sent.
+  std::mutex snapshotMutex_;
+  Snapshot newSnapshot_;  // From the matching thread, under snapshotMutex_.
+  std::array<char, REPLICATION_DATAGRAM_SIZE> buffer_;
+  std::atomic<bool> stopFlag_                = false;
+  std::atomic<bool> snapshotWanted_          = false;
+  std::atomic<bool> snapshotReady_           = false;  // newSnapshot_ is set.
+  std::atomic<std::uint64_t> sentOrders_     = 0;
+  std::atomic<std::uint64_t> resentOrders_   = 0;
+  std::atomic<std::uint64_t> resendRequests_ = 0;
+  std::atomic<std::uint64_t> tooOldRequests_ = 0;
+  std::atomic<std::uint64_t> droppedOrders_  = 0;
+  std::atomic<std::uint64_t> snapshots_      = 0;
+  std::atomic<std::size_t> logOrders_        = 0;
+  std::atomic<std::size_t> logBytes_         = 0;
+  std::atomic<std::size_t> logHighWater_     = 0;
+  std::jthread thread_;
+};
+
+using ReplicationManager = BasicReplicationManager<REPLICATION_QUEUE_CAPACITY>;
+
+#endif  // #ifndef REPLICATION_MANAGER_H
@@ -0,0 +1,178 @@
+#ifndef REPORT_MANAGER_H
+#define REPORT_MANAGER_H
+
+/////////////////
+/// std
+/////////////////
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "ingest_manager.h"
+#include "order_book.h"
+#include "serialization.h"
+#include "socket_wrappers.h"
+#include "spsc_queue.h"
+
+// One datagram sent from the server to a client: every event for that client from one batch.
+struct ExecutionReport {
+  std::vector<Event> events;
+
+  template <typename Archive>
+  void serialize(Archive& archive) {
+    archive& events;
+  }
+};
+
+// The events produced by one order, plus where that order came from.
+struct ReportBatch {
+  UserId_type userId = -1;
+  sockaddr_storage source{};
+  socklen_t sourceLen = 0;
+  std::vector<Event> events;
+};
+
+// Sends execution reports back to clients on its own thread. The matching thread only pushes the
+// events of each order into a lock-free queue. The report thread keeps the address each user last
+// sent from, routes acks, fills and cancel confirmations to the users involved and coalesces them
+// into one datagram per user per batch. Top of book updates are not sent to clients. If given the
+// IngestManager, it also reports the orders that admission control turned away.
+class ReportManager {
+public:
+  using Queue_type = SPSCQueue<ReportBatch, REPORT_QUEUE_CAPACITY>;
+
+  explicit ReportManager(int fd, IngestManager* ingest = nullptr)
+      : fd_(fd), ingest_(ingest), queue_(std::make_unique<Queue_type>()) {
+    thread_ = std::jthread(&ReportManager::Run, this);
+  }
+
+  ~ReportManager() {
+    stopFlag_ = true;
+    thread_.join();
+  }
+
+  ReportManager(const ReportManager&)  = delete;
+  void operator=(const ReportManager&) = delete;
+
+  // Called by the matching thread, never blocks. Reports are best effort (the server log is the
+  // record of truth), so if the report thread falls behind the batch is dropped and counted.
+  void Push(ReportBatch&& batch) {
+    if (!queue_->TryPush(std::move(batch))) {
+      droppedBatches_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  std::uint64_t GetSentReports() const { return sentReports_.load(std::memory_order_relaxed); }
+  std::uint64_t GetDroppedBatches() const {
+    return droppedBatches_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Client {
+    sockaddr_storage address{};
+    socklen_t addressLen = 0;
+    ExecutionReport pending;
+  };
+
+  void Run() {
+    std::vector<UserId_type> touched;
+    IdleBackoff backoff;
+    while (true) {
+      const auto stopping = stopFlag_.load();
+      auto count          = queue_->ConsumeBatch(
+          [&](ReportBatch&& batch) { Route(std::move(batch), touched); }, REPORT_BATCH_SIZE);
+      if (ingest_ != nullptr) {
+        count += ingest_->PollRejects([&](RejectNotice&& notice) {
+          SetAddress(notice.event.userId, notice.source, notice.sourceLen);
+          AddEvent(notice.event.userId, notice.event, touched);
+        });
+      }
+      for (const auto userId : touched) {
+        Send(clients_.at(userId));
+      }
+      touched.clear();
+      if (count > 0) {
+        backoff.Reset();
+      } else if (stopping) {
+        break;
+      } else {
+        backoff.Wait();
+      }
+    }
+  }
+
+  void SetAddress(UserId_type userId, const sockaddr_storage& source, socklen_t sourceLen) {
+    if (userId != -1 && sourceLen > 0) {
+      auto& client      = clients_[userId];
+      client.address    = source;
+      client.addressLen = sourceLen;
+    }
+  }
+
+  void Route(ReportBatch&& batch, std::vector<UserId_type>& touched) {
+    SetAddress(batch.userId, batch.source, batch.sourceLen);
+    for (const auto& event : batch.events) {
+      switch (event.eventType) {
+        case (Event::EventType::ACK):
+        case (Event::EventType::CANCEL):
+        case (Event::EventType::REJECT):
+          AddEvent(event.userId, event, touched);
+          break;
+        case (Event::EventType::TRADE):
+          AddEvent(event.userId, event, touched);
+          AddEvent(event.otherUserId, event, touched);
+          break;
+        case (Event::EventType::TOP_OF_BOOK):
+          break;
+      }
+    }
+  }
+
+  void AddEvent(UserId_type userId, const Event& event, std::vector<UserId_type>& touched) {
+    auto it = clients_.find(userId);
+    if (it == clients_.end()) {
+      return;  // Never heard from this user, nowhere to send to.
+    }
+    auto& events = it->second.pending.events;
+    if (events.empty()) {
+      touched.push_back(userId);
+    }
+    events.push_back(event);
+  }
+
+  void Send(Client& client) {
+    auto& events = client.pending.events;
+    // Split so every datagram stays within MAX_DATAGRAM_SIZE.
+    for (std::size_t first = 0; first < events.size(); first += MAX_EVENTS_PER_REPORT) {
+      const auto last = std::min(events.size(), first + MAX_EVENTS_PER_REPORT);
+      ExecutionReport report;
+      report.events.assign(events.begin() + first, events.begin() + last);
+      const auto serializedReport = SerializeObject(report);
+      // A client that went away must not take the report thread down with it.
+      sendto(fd_, serializedReport.data(), serializedReport.size(), 0,
+             reinterpret_cast<const sockaddr*>(&client.address), client.addressLen);
+      sentReports_.fetch_add(1, std::memory_order_relaxed);
+    }
+    events.clear();
+  }
+
+  int fd_                 = -1;
+  IngestManager* ingest_ = nullptr;
+  std::unique_ptr<Queue_type> queue_;
+  std::unordered_map<UserId_type, Client> clients_;
+  std::atomic<bool> stopFlag_                = false;
+  std::atomic<std::uint64_t> sentReports_    = 0;
+  std::atomic<std::uint64_t> droppedBatches_ = 0;
+  std::jthread thread_;
+};
+
+#endif  // #ifndef REPORT_MANAGER_H
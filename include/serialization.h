@@ -41,4 +41,13 @@ void DeserializeObject(T& object, const Buf_T& buffer) {
   archive_i >> object;
 }
 
+// For buffers whose length is known, such as a received datagram.
+template <typename T>
+void DeserializeObject(T& object, const char* buffer, std::size_t length) {
+  auto stringBuffer = std::string(buffer, length);
+  std::istringstream iss(stringBuffer);
+  cereal::BinaryInputArchive archive_i(iss);
+  archive_i >> object;
+}
+
 #endif  // #ifndef SERIALIZATION_H
@@ -6,121 +6,264 @@
 /////////////////
 #include <unistd.h>
 
-#include <condition_variable>
-#include <mutex>
-#include <queue>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
 #include <thread>
-#include <fstream>
+#include <vector>
 
 /////////////////
 /// local
 /////////////////
+#include "capture_manager.h"
 #include "config.h"
+#include "ingest_manager.h"
+#include "log_manager.h"
 #include "order_book.h"
+#include "replication_manager.h"
+#include "report_manager.h"
 #include "serialization.h"
 #include "socket_wrappers.h"
+#include "standby_manager.h"
+
+struct ServerConfig {
+  bool standby                = false;  // Follow a primary's stream, take over if it goes silent.
+  std::string standbyHost     = "";     // Primary only: replicate to the standby on this host.
+  std::string replicationPort = REPLICATION_PORT;
+  std::string captureFile     = "";     // Record every order applied to the books to this file.
+  bool captureCompress        = false;  // zlib compress the capture's blocks.
+  BookLimits bookLimits;
+  std::size_t maxQueuedEvents = SERVER_MAX_QUEUED_EVENTS;  // Server log events held unwritten.
+};
 
 class ServerManager {
 public:
   ServerManager(const ServerManager&)  = delete;
   void operator=(const ServerManager&) = delete;
 
-  static ServerManager& GetServerManager() {
-    static ServerManager serverManager;
+  // The config is taken from the first call.
+  static ServerManager& GetServerManager(const ServerConfig& config = {}) {
+    static ServerManager serverManager(config);
     return serverManager;
   }
 
-  ~ServerManager() {
-    runThread_.join();
-    publishThread_.join();
+  ~ServerManager() { runThread_.join(); }
 
-    freeaddrinfo(serverAddrInfo_);
-    close(serverFd_);
-  }
+  // Per symbol trade aggregates, kept by the matching thread and safe to read from any thread.
+  const TradeAnalytics& GetTradeAnalytics() const { return orderBooks_.GetTradeAnalytics(); }
 
 private:
+  // Matching stage. Drains the ingest queues in order and applies each batch of orders to the books.
+  // A standby first follows the primary, and only starts taking orders once it takes over.
   void Run() {
-    static socklen_t addrStorageLen = sizeof(addrStorage_);
+    if (config_.standby && !Follow()) {
+      std::cout << "Standby shutting down.\n";
+      stopFlag_ = true;
+      log_.Stop();
+      return;
+    }
+    ingest_  = std::make_unique<IngestManager>();
+    reports_ = std::make_unique<ReportManager>(ingest_->GetFd(), ingest_.get());
+    if (!config_.standbyHost.empty()) {
+      replication_ =
+          std::make_unique<ReplicationManager>(config_.standbyHost, config_.replicationPort);
+    }
+    if (!config_.captureFile.empty()) {
+      capture_ = std::make_unique<CaptureManager>(config_.captureFile, config_.captureCompress);
+    }
+
+    auto lastOrderTime = std::chrono::steady_clock::now();
+    IdleBackoff backoff;
+    std::vector<InboundOrder> inbound;
+    std::vector<Order> orders;
+    inbound.reserve(INGEST_BATCH_SIZE * ingest_->NumSockets());
+    orders.reserve(INGEST_BATCH_SIZE * ingest_->NumSockets());
     while (!stopFlag_) {
-      Order order;
-      auto status = RecvAndDeserialize(order, serverFd_, reinterpret_cast<sockaddr*>(&addrStorage_),
-                                       &addrStorageLen);
-      if (status == 0) {
+      inbound.clear();
+      orders.clear();
+      const auto count = ingest_->Poll([&](InboundOrder&& order) {
+        // Writing the log has fallen behind, new orders are turned away. Before replication and
+        // capture, so that the standby and replays never see them.
+        if (!log_.Admits(order.order)) {
+          ++memoryRejects_;
+          ingest_->Release(order);
+          reports_->Push({order.order.userId, order.source, order.sourceLen,
+                          {Event::Reject(order.order.userId, order.order.userOrderId,
+                                         Event::RejectReason::MEMORY_LIMIT)}});
+          return;
+        }
+        if (replication_) {
+          replication_->Push(order.order);
+        }
+        if (capture_) {
+          capture_->Push(order.receiveTime, order.order);
+        }
+        orders.push_back(std::move(order.order));
+        inbound.push_back(std::move(order));
+      });
+      orderBooks_.HandleOrders(
+          orders, [&](std::size_t i, std::optional<std::vector<Event>>&& logVec) {
+            ingest_->Release(inbound[i]);
+            if (!logVec.has_value()) {  // Flush orderbooks.
+              log_.Flush();
+            } else {
+              log_.Add(logVec.value());
+              // A moved from order keeps its ids.
+              reports_->Push({orders[i].userId, inbound[i].source, inbound[i].sourceLen,
+                              std::move(logVec.value())});
+            }
+          });
+      if (replication_ && replication_->SnapshotWanted()) {
+        replication_->PushSnapshot(SerializeObject(orderBooks_.Snapshot()));
+      }
+      const auto now = std::chrono::steady_clock::now();
+      if (count > 0) {
+        lastOrderTime = now;
+        backoff.Reset();
+        continue;
+      }
+      if (now - lastOrderTime > std::chrono::seconds(SERVER_IDLE_TIMEOUT_SECONDS)) {
         // Timeout, assume program is over.
         std::cout << "No orders recieved, server shutting down.\n";
+        PrintIngestStats();
+        std::cout << "Execution reports: " << reports_->GetSentReports() << " sent, "
+                  << reports_->GetDroppedBatches() << " batches dropped\n";
+        if (replication_) {
+          replication_->Stop();
+          const auto stats = replication_->GetStats();
+          std::cout << "Replication: " << stats.sentOrders << " orders sent, "
+                    << stats.resentOrders << " resent for " << stats.resendRequests
+                    << " requests (" << stats.tooOldRequests << " too old), "
+                    << stats.snapshots << " snapshots, " << stats.droppedOrders
+                    << " orders dropped with the queue full\n";
+        }
+        if (capture_) {
+          capture_->Stop();
+          const auto stats = capture_->GetStats();
+          std::cout << "Capture: " << stats.capturedOrders << " orders in " << stats.writtenBytes
+                    << " bytes, " << stats.queueStalls << " queue stalls";
+          if (stats.writeFailures > 0) {
+            std::cout << ", stopped by a write failure, " << stats.droppedOrders
+                      << " orders not recorded";
+          }
+          std::cout << '\n';
+        }
+        PrintMemoryStats();
+        ingest_->Stop();
         stopFlag_ = true;
-        cv_.notify_all();
+        log_.Stop();
         break;
       }
-      const auto logVec = orderBooks_.HandleOrder(std::move(order));
-      if(!logVec.has_value()){ //Flush orderbooks.
-        FlushBooks();
-      }else{
-        AddToServerLog(logVec.value());
-      }
+      backoff.Wait();
     }
   }
 
-  void FlushBooks(){
-    cv_.notify_one(); // Notify publish thread.
-    std::unique_lock uniqueLock(mutex_); //Get a unique lock.
-    cv_.wait(uniqueLock, [&] { return serverLog_.empty(); }); //Block until serverLog is emptied.
+  // Standby. Applies the primary's orders to our books as they arrive, publishing nothing. Returns
+  // true once the primary is lost and we should take over. False if it shut down cleanly, or was
+  // lost while our books were out of sync: taking over with books that differ from the primary's
+  // would trade against orders that no longer exist.
+  bool Follow() {
+    StandbyManager standby(config_.replicationPort);
+    std::vector<Order> orders;
+    orders.reserve(REPLICATION_QUEUE_CAPACITY);
+    auto apply = [&] {
+      orders.clear();
+      standby.Poll([&](Order&& order) { orders.push_back(std::move(order)); });
+      orderBooks_.HandleOrders(orders, [](std::size_t, std::optional<std::vector<Event>>&&) {});
+      return orders.size();
+    };
+    IdleBackoff backoff;
+    while (true) {
+      if (apply() > 0) {
+        backoff.Reset();
+        continue;
+      }
+      if (auto snapshot = standby.TakeSnapshot()) {
+        OrderBooksSnapshot books;
+        DeserializeObject(books, snapshot->data(), snapshot->size());
+        orderBooks_.LoadSnapshot(books);
+        backoff.Reset();
+        continue;
+      }
+      if (standby.PrimaryStopped()) {
+        std::cout << "Primary shut down.\n";
+        return false;
+      }
+      if (standby.PrimaryLost()) {
+        // Once the receive thread is stopped the queue only shrinks, so this is bounded by its
+        // capacity.
+        standby.Stop();
+        while (apply() > 0) {
+        }
+        const auto stats = standby.GetStats();
+        if (!standby.InSync()) {
+          std::cout << "Primary lost with the books out of sync, not taking over ("
+                    << stats.lostOrders << " orders were too old for the primary to resend).\n";
+          return false;
+        }
+        std::cout << "Primary lost, taking over after order " << stats.lastSequence << " ("
+                  << stats.gaps << " gaps, " << stats.resendRequests << " resend requests, "
+                  << stats.duplicateOrders << " duplicates, " << stats.snapshots
+                  << " snapshots)\n";
+        return true;
+      }
+      backoff.Wait();
+    }
   }
 
-  void AddToServerLog(const std::vector<std::string>& logVec){
-    std::unique_lock uniqueLock(mutex_); //Get a unique lock.
-    for (const auto& logStr : logVec) {
-      serverLog_.push(logStr);
+  void PrintIngestStats() const {
+    const auto stats = ingest_->GetStats();
+    for (std::size_t i = 0; i < stats.sockets.size(); ++i) {
+      const auto& socket = stats.sockets[i];
+      std::cout << "Ingest socket " << i << ": " << socket.datagrams << " datagrams, "
+                << socket.decodeErrors << " decode errors, " << socket.kernelDrops
+                << " kernel drops, " << socket.queueStalls << " queue stalls, "
+                << socket.recvBufferBytes << " byte receive buffer\n"
+                << "  rejected: " << socket.rateLimited << " rate limited, " << socket.symbolCapped
+                << " over the symbol in-flight cap, " << socket.shed << " shed, "
+                << socket.rejectsLost << " not reported\n";
     }
   }
 
-  void WriteLog(){
-    std::cout << "============Writing Log " << ++id_ << "============\n";
-    const std::string outputFileStr = ROOT_DIR + "/logs/" + std::to_string(id_) + ".log";
-    std::ofstream outputFile(outputFileStr);
-    if(!outputFile.is_open()){
-      throw std::runtime_error("Couldn't write to outputFile in WriteLog");
+  // Matching thread.
+  MemoryStats GetMemoryStats() const {
+    auto stats = orderBooks_.GetMemoryStats();
+    if (replication_) {
+      stats.replicationLog = replication_->GetLogMemory();
     }
-    while(!serverLog_.empty()){
-      auto logMsg = serverLog_.front();
-      serverLog_.pop();
-      outputFile << logMsg << '\n';
-      std::cout << logMsg << '\n';
-    }
-    outputFile.close();
+    return stats;
   }
 
-  void Publish(){
-    while (!stopFlag_) {
-      std::unique_lock uniqueLock(mutex_);
-      cv_.wait(uniqueLock, [&] { return !serverLog_.empty() || stopFlag_; });
-      if (stopFlag_) {
-        break;
-      }
-      WriteLog();
-      cv_.notify_all();
-    }
+  void PrintMemoryStats() const {
+    const auto stats    = GetMemoryStats();
+    const auto logStats = log_.GetStats();
+    std::cout << "Memory: " << stats.Bytes() << " bytes in " << stats.books.size()
+              << " books, high water " << stats.orderBooks.highWaterElements << " books, "
+              << stats.orderIdMap.highWaterElements << " resting orders, "
+              << stats.maxOrderIdMap.highWaterElements << " users, "
+              << stats.replicationLog.highWaterElements << " orders kept for resends\n"
+              << "  rejected: " << stats.rejectedOrders << " over a book limit, " << memoryRejects_
+              << " with the log full (high water " << logStats.queuedEventsHighWater
+              << " events, " << logStats.writtenChunks << " chunks written ahead of a flush)\n";
   }
 
-  ServerManager() {
-    SetAddrInfo(&serverAddrInfo_);
-    SetSocket(serverAddrInfo_, serverFd_);
-    BindSocket(serverAddrInfo_, serverFd_);
+  explicit ServerManager(const ServerConfig& config)
+      : config_(config), log_(ROOT_DIR + "/logs", config_.maxQueuedEvents) {
+    orderBooks_.SetBookLimits(config_.bookLimits);
     runThread_ = std::jthread(&ServerManager::Run, this);
-    publishThread_ = std::jthread(&ServerManager::Publish, this);
   }
 
-  int serverFd_             = -1;
+  ServerConfig config_;
+  LogManager log_;
+  std::unique_ptr<IngestManager> ingest_;
+  std::unique_ptr<ReportManager> reports_;
+  std::unique_ptr<ReplicationManager> replication_;
+  std::unique_ptr<CaptureManager> capture_;
   std::jthread runThread_;
-  std::jthread publishThread_;
-  addrinfo* serverAddrInfo_ = nullptr;
-  sockaddr_storage addrStorage_{};
   OrderBooks orderBooks_;
-  std::atomic<bool> stopFlag_ = false;
-  std::condition_variable cv_;
-  std::mutex mutex_;
-  std::queue<std::string> serverLog_;
-  std::atomic<int> id_ = 0;
+  std::atomic<bool> stopFlag_  = false;
+  std::uint64_t memoryRejects_ = 0;
 };
 
 #endif  // #ifndef SERVER_H
@@ -9,35 +9,80 @@
 #include <sys/socket.h>  //sockets
 #include <sys/types.h>   //types
 
+#include <chrono>
+
 /////////////////
 /// local
 /////////////////
 #include "serialization.h"
 
 #define PORT "8888"
+#define REPLICATION_PORT "8889"
 
-void SetAddrInfo(addrinfo** addrInfo) {
+// host == nullptr gives the wildcard address, for binding. Sockets are always IPv6, which on Linux
+// also serve IPv4: a bound one takes both, and an IPv4 host is returned as ::ffff:a.b.c.d.
+void SetAddrInfo(addrinfo** addrInfo, const char* host, const char* port) {
   addrinfo tempAddrInfo{};
   tempAddrInfo.ai_family   = AF_INET6;
   tempAddrInfo.ai_socktype = SOCK_DGRAM;
-  tempAddrInfo.ai_flags    = AI_PASSIVE;
-  auto getAddrInfoStatus   = getaddrinfo(nullptr, PORT, &tempAddrInfo, addrInfo);
-  if (getAddrInfoStatus < 0) {
+  tempAddrInfo.ai_flags    = (host == nullptr) ? AI_PASSIVE : AI_V4MAPPED;
+  auto getAddrInfoStatus   = getaddrinfo(host, port, &tempAddrInfo, addrInfo);
+  if (getAddrInfoStatus != 0) {
     throw std::runtime_error("Error getting AddrInfo.");
   }
 }
 
+void SetAddrInfo(addrinfo** addrInfo) { SetAddrInfo(addrInfo, nullptr, PORT); }
+
+void SetRecvTimeout(int fd, std::chrono::microseconds timeOut) {
+  timeval timeVal{};
+  timeVal.tv_sec  = timeOut.count() / 1'000'000;
+  timeVal.tv_usec = timeOut.count() % 1'000'000;
+  auto setOptions = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeVal, sizeof(timeVal));
+  if (setOptions < 0) {
+    throw std::runtime_error("Error setting socket settings.");
+  }
+}
+
 void SetSocket(addrinfo* addrInfo, int& fd, int secondsTimeOut = 2) {
   fd = socket(addrInfo->ai_family, addrInfo->ai_socktype, addrInfo->ai_protocol);
   if (fd < 0) {
     throw std::runtime_error("Error setting socket.");
   }
 
-  timeval timeVal{};
-  timeVal.tv_sec = secondsTimeOut;
-  auto setOptions = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeVal, sizeof(timeVal));
+  SetRecvTimeout(fd, std::chrono::seconds(secondsTimeOut));
+}
+
+// Lets several sockets bind the same port, the kernel then spreads datagrams across them by hashing
+// the source address, so every datagram from a given client lands on the same socket.
+void SetReusePort(int fd) {
+  int enable      = 1;
+  auto setOptions = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
   if (setOptions < 0) {
-    throw std::runtime_error("Error setting socket settings.");
+    throw std::runtime_error("Error setting SO_REUSEPORT.");
+  }
+}
+
+// Tries SO_RCVBUFFORCE first (ignores rmem_max, needs CAP_NET_ADMIN), then falls back to SO_RCVBUF.
+// Returns the size the kernel actually granted.
+int SetRecvBufferSize(int fd, int bytes) {
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) < 0) {
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0) {
+      throw std::runtime_error("Error setting SO_RCVBUF.");
+    }
+  }
+  int granted   = 0;
+  socklen_t len = sizeof(granted);
+  getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &granted, &len);
+  return granted;
+}
+
+// Asks the kernel to attach its running count of datagrams dropped on this socket to every message.
+void EnableDropCounter(int fd) {
+  int enable      = 1;
+  auto setOptions = setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+  if (setOptions < 0) {
+    throw std::runtime_error("Error setting SO_RXQ_OVFL.");
   }
 }
 
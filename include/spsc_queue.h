@@ -0,0 +1,141 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <thread>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+
+// Bounded lock-free single producer/single consumer ring buffer. Capacity must be a power of two.
+// The producer publishes a whole batch with one release store, so the consumer never observes a
+// partially written batch.
+template <typename T, std::size_t Capacity>
+class SPSCQueue {
+  static_assert(Capacity > 1 && (Capacity & (Capacity - 1)) == 0,
+                "SPSCQueue capacity must be a power of two");
+
+public:
+  bool TryPush(T&& value) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - headCache_ == Capacity) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      if (tail - headCache_ == Capacity) {
+        return false;
+      }
+    }
+    buffer_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Moves as many elements of [first, last) as fit, returns the number pushed.
+  template <typename It>
+  std::size_t TryPushBatch(It first, It last) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    auto free       = Capacity - (tail - headCache_);
+    if (free < static_cast<std::size_t>(std::distance(first, last))) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      free       = Capacity - (tail - headCache_);
+    }
+    std::size_t pushed = 0;
+    for (; first != last && pushed < free; ++first, ++pushed) {
+      buffer_[(tail + pushed) & mask_] = std::move(*first);
+    }
+    if (pushed > 0) {
+      tail_.store(tail + pushed, std::memory_order_release);
+    }
+    return pushed;
+  }
+
+  bool TryPop(T& value) {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tailCache_) {
+      tailCache_ = tail_.load(std::memory_order_acquire);
+      if (head == tailCache_) {
+        return false;
+      }
+    }
+    value = std::move(buffer_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Hands up to maxCount elements to func in FIFO order, returns the number consumed.
+  template <typename F>
+  std::size_t ConsumeBatch(F&& func, std::size_t maxCount) {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tailCache_) {
+      tailCache_ = tail_.load(std::memory_order_acquire);
+    }
+    const auto count = std::min(maxCount, tailCache_ - head);
+    for (std::size_t i = 0; i < count; ++i) {
+      func(std::move(buffer_[(head + i) & mask_]));
+    }
+    if (count > 0) {
+      head_.store(head + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  std::size_t SizeApprox() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  bool Empty() const { return SizeApprox() == 0; }
+
+  static constexpr std::size_t capacity = Capacity;
+
+private:
+  static constexpr std::size_t mask_ = Capacity - 1;
+  static constexpr std::size_t cacheLineSize_ = 64;
+
+  // Producer and consumer indices live on separate cache lines, each next to the side's cached copy
+  // of the other index.
+  alignas(cacheLineSize_) std::atomic<std::size_t> head_ = 0;
+  std::size_t tailCache_                                = 0;
+  alignas(cacheLineSize_) std::atomic<std::size_t> tail_ = 0;
+  std::size_t headCache_                                = 0;
+  alignas(cacheLineSize_) std::array<T, Capacity> buffer_{};
+};
+
+// How a consumer waits while its queues are empty. For IDLE_SPIN_MICROS after the last work it only
+// yields, so a burst is picked up at once, then it sleeps IDLE_SLEEP_MICROS between polls so that
+// an idle thread doesn't keep a core busy.
+class IdleBackoff {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Call after a poll that found work.
+  void Reset() { idle_ = false; }
+
+  // Call after a poll that found nothing.
+  void Wait() {
+    const auto now = Clock::now();
+    if (!idle_) {
+      idle_      = true;
+      idleSince_ = now;
+    }
+    if (now - idleSince_ < std::chrono::microseconds(IDLE_SPIN_MICROS)) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(IDLE_SLEEP_MICROS));
+    }
+  }
+
+private:
+  bool idle_ = false;
+  Clock::time_point idleSince_;  // Set once idle_.
+};
+
+#endif  // #ifndef SPSC_QUEUE_H
@@ -0,0 +1,375 @@
+#ifndef STANDBY_MANAGER_H
+#define STANDBY_MANAGER_H
+
+/////////////////
+/// std
+/////////////////
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "order_book.h"
+#include "replication_manager.h"
+#include "serialization.h"
+#include "socket_wrappers.h"
+#include "spsc_queue.h"
+
+struct StandbyStats {
+  std::uint64_t appliedOrders   = 0;  // Handed to the matching thread, in sequence.
+  std::uint64_t duplicateOrders = 0;
+  std::uint64_t gaps            = 0;  // Times a missing order was noticed.
+  std::uint64_t resendRequests  = 0;
+  std::uint64_t skippedOrders   = 0;  // Missed, but made irrelevant by a later FLUSH.
+  std::uint64_t lostOrders      = 0;  // Missed, and too old for the primary to resend.
+  std::uint64_t snapshots       = 0;  // Snapshots of the primary's books loaded.
+  std::uint64_t lastSequence    = 0;  // Last order handed to the matching thread.
+};
+
+// Standby side of replication. A receive thread puts the primary's orders back in sequence and
+// hands them to the matching thread through a lock-free queue, the matching thread applies them to
+// its own books exactly as the primary did. Missing orders are asked for again, both when a later
+// one arrives first and when a heartbeat shows the primary is ahead of us.
+//
+// If the primary no longer has the orders we miss (TOO_OLD), our books can't be rebuilt from its
+// stream, which is also where a standby started after the primary ends up. Orders are then dropped
+// and the standby reports that it is out of sync, until either the next FLUSH resets the books or a
+// snapshot of the primary's books arrives. The matching thread loads that in place of its own books
+// (TakeSnapshot), and the orders after it follow once it has.
+//
+// The primary counts as lost once it has been silent for REPLICATION_TAKEOVER_MS. The standby's
+// books are then current up to what is left in the queue, so taking over costs that timeout plus
+// draining at most REPLICATION_QUEUE_CAPACITY orders, however large the books are.
+class StandbyManager {
+public:
+  using Queue_type = SPSCQueue<Order, REPLICATION_QUEUE_CAPACITY>;
+
+  explicit StandbyManager(const std::string& port = REPLICATION_PORT)
+      : queue_(std::make_unique<Queue_type>()) {
+    SetAddrInfo(&addrInfo_, nullptr, port.c_str());
+    SetSocket(addrInfo_, fd_);
+    SetRecvTimeout(fd_, std::chrono::milliseconds(1));
+    BindSocket(addrInfo_, fd_);
+    thread_ = std::jthread(&StandbyManager::Receive, this);
+  }
+
+  ~StandbyManager() {
+    Stop();
+    freeaddrinfo(addrInfo_);
+    close(fd_);
+  }
+
+  StandbyManager(const StandbyManager&) = delete;
+  void operator=(const StandbyManager&) = delete;
+
+  // Stops receiving. Once this returns nothing more is added to the queue, what is in it can still
+  // be polled.
+  void Stop() {
+    stopFlag_ = true;
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // Called by the matching thread. Hands up to maxCount orders to func, in sequence.
+  template <typename F>
+  std::size_t Poll(F&& func, std::size_t maxCount = REPLICATION_QUEUE_CAPACITY) {
+    return queue_->ConsumeBatch(func, maxCount);
+  }
+
+  // Heard from a primary, then nothing for REPLICATION_TAKEOVER_MS.
+  bool PrimaryLost() const {
+    const auto lastContact = lastContact_.load(std::memory_order_acquire);
+    return lastContact != 0 && Clock::now() - Clock::time_point(Clock::duration(lastContact)) >
+                                   std::chrono::milliseconds(REPLICATION_TAKEOVER_MS);
+  }
+
+  // The primary said it is shutting down, there is nothing to take over.
+  bool PrimaryStopped() const { return primaryStopped_.load(std::memory_order_acquire); }
+
+  // The books we hand out match the primary's. False from a TOO_OLD until the next FLUSH or a
+  // snapshot is loaded.
+  bool InSync() const { return inSync_.load(std::memory_order_acquire); }
+
+  // Called by the matching thread. A serialized OrderBooksSnapshot to replace its books with, once
+  // it has applied everything queued before it.
+  std::optional<std::string> TakeSnapshot() {
+    if (!snapshotReady_.load(std::memory_order_acquire) || !queue_->Empty()) {
+      return std::nullopt;
+    }
+    auto snapshot = std::move(readySnapshot_);
+    readySnapshot_.clear();
+    snapshotReady_.store(false, std::memory_order_release);
+    return snapshot;
+  }
+
+  StandbyStats GetStats() const {
+    return {appliedOrders_.load(std::memory_order_relaxed),
+            duplicateOrders_.load(std::memory_order_relaxed),
+            gaps_.load(std::memory_order_relaxed),
+            resendRequests_.load(std::memory_order_relaxed),
+            skippedOrders_.load(std::memory_order_relaxed),
+            lostOrders_.load(std::memory_order_relaxed),
+            snapshots_.load(std::memory_order_relaxed),
+            nextSequence_.load(std::memory_order_relaxed) - 1};
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  void Receive() {
+    while (!stopFlag_) {
+      if (holding_ && !snapshotReady_.load(std::memory_order_acquire)) {
+        // The matching thread has loaded the snapshot, the orders after it can follow.
+        holding_ = false;
+        inSync_.store(true, std::memory_order_release);
+        snapshots_.fetch_add(1, std::memory_order_relaxed);
+        DeliverPending(nextSequence_.load(std::memory_order_relaxed));
+      }
+      if (!inSync_.load(std::memory_order_relaxed) && !holding_) {
+        RequestSnapshot(false);
+      }
+      primaryLen_           = sizeof(primary_);
+      const auto readStatus = recvfrom(fd_, buffer_.data(), buffer_.size(), 0,
+                                       reinterpret_cast<sockaddr*>(&primary_), &primaryLen_);
+      if (readStatus < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Error recving in StandbyManager::Receive.");
+      }
+      ReplicationMessage message;
+      try {
+        DeserializeObject(message, buffer_.data(), readStatus);
+      } catch (const std::exception&) {
+        continue;
+      }
+      lastContact_.store(Clock::now().time_since_epoch().count(), std::memory_order_release);
+
+      const auto nextSequence = nextSequence_.load(std::memory_order_relaxed);
+      switch (message.messageType) {
+        case (ReplicationMessage::MessageType::ORDERS):
+          for (std::size_t i = 0; i < message.orders.size(); ++i) {
+            Accept(message.firstSequence + i, std::move(message.orders[i]));
+          }
+          if (!pending_.empty()) {
+            // Something between what we have applied and what we are holding went missing.
+            RequestResend(nextSequence_.load(std::memory_order_relaxed),
+                          pending_.begin()->first - 1);
+          }
+          break;
+        case (ReplicationMessage::MessageType::HEARTBEAT):
+          if (message.lastSequence >= nextSequence) {
+            // The last orders sent went missing, nothing after them to show it.
+            RequestResend(nextSequence, message.lastSequence);
+          }
+          break;
+        case (ReplicationMessage::MessageType::SHUTDOWN):
+          primaryStopped_.store(true, std::memory_order_release);
+          break;
+        case (ReplicationMessage::MessageType::TOO_OLD):
+          // Holding, the orders after the snapshot went missing. Asked for again once it is
+          // loaded, the answer to that tells whether a new snapshot is needed.
+          if (message.firstSequence > nextSequence && !holding_) {
+            SkipTo(message.firstSequence);
+          }
+          break;
+        case (ReplicationMessage::MessageType::SNAPSHOT):
+          AcceptSnapshot(message);
+          break;
+        case (ReplicationMessage::MessageType::RESEND):
+        case (ReplicationMessage::MessageType::SNAPSHOT_REQUEST):
+          break;
+      }
+    }
+  }
+
+  void Accept(std::uint64_t sequence, Order&& order) {
+    auto nextSequence = nextSequence_.load(std::memory_order_relaxed);
+    if (sequence < nextSequence) {
+      duplicateOrders_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (sequence > nextSequence && order.orderType == Order::OrderType::FLUSH) {
+      // A FLUSH resets every book, so whatever we missed before it no longer matters.
+      const auto held = pending_.lower_bound(sequence);
+      skippedOrders_.fetch_add(sequence - nextSequence - std::distance(pending_.begin(), held),
+                               std::memory_order_relaxed);
+      pending_.erase(pending_.begin(), held);
+      nextSequence = sequence;
+    }
+    if (sequence > nextSequence || holding_) {
+      if (pending_.size() < REPLICATION_MAX_PENDING) {
+        pending_.emplace(sequence, std::move(order));
+      }
+      return;
+    }
+
+    Deliver(std::move(order));
+    DeliverPending(nextSequence + 1);
+  }
+
+  // The primary can't resend anything before first. What we missed up to there is lost, and the
+  // books stay out of sync until a FLUSH.
+  void SkipTo(std::uint64_t first) {
+    const auto nextSequence = nextSequence_.load(std::memory_order_relaxed);
+    lostOrders_.fetch_add(first - nextSequence, std::memory_order_relaxed);
+    pending_.erase(pending_.begin(), pending_.lower_bound(first));
+    inSync_.store(false, std::memory_order_release);
+    DeliverPending(first);
+  }
+
+  // Delivers what was held from nextSequence on, for as long as there is no gap.
+  void DeliverPending(std::uint64_t nextSequence) {
+    for (auto it = pending_.begin(); it != pending_.end() && it->first == nextSequence;
+         it = pending_.erase(it)) {
+      Deliver(std::move(it->second));
+      ++nextSequence;
+    }
+    nextSequence_.store(nextSequence, std::memory_order_relaxed);
+  }
+
+  // Orders must not be lost here, if the matching thread is behind, wait for it. Out of sync, only
+  // a FLUSH is worth applying.
+  void Deliver(Order&& order) {
+    if (!inSync_.load(std::memory_order_relaxed)) {
+      if (order.orderType != Order::OrderType::FLUSH) {
+        skippedOrders_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      inSync_.store(true, std::memory_order_release);
+      snapshot_.clear();
+    }
+    while (!queue_->TryPush(std::move(order))) {
+      if (stopFlag_) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+    appliedOrders_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Puts the snapshot together from its chunks, in order. A chunk from the start of another one
+  // means the primary has taken a new snapshot.
+  void AcceptSnapshot(const ReplicationMessage& message) {
+    if (inSync_.load(std::memory_order_relaxed) || holding_) {
+      return;  // Back in step through a FLUSH, or already have one.
+    }
+    if (message.firstSequence == 0 &&
+        (snapshot_.empty() || message.lastSequence != snapshotSequence_)) {
+      snapshot_.clear();
+      snapshotSequence_ = message.lastSequence;
+      snapshotAsked_    = REPLICATION_SNAPSHOT_WINDOW * REPLICATION_SNAPSHOT_CHUNK;
+    } else if (message.lastSequence != snapshotSequence_ ||
+               message.firstSequence != snapshot_.size()) {
+      return;  // Lost the chunk before it, asked for again below or on the next timeout.
+    }
+    snapshot_ += message.snapshot;
+    if (snapshot_.size() >= message.snapshotBytes) {
+      HandOverSnapshot();
+    } else if (snapshot_.size() >= snapshotAsked_) {
+      RequestSnapshot(true);
+    }
+  }
+
+  // The books are now those of the primary after order snapshotSequence_. Orders from there on are
+  // held until the matching thread has loaded them, those already dropped are asked for again.
+  void HandOverSnapshot() {
+    const auto nextSequence = snapshotSequence_ + 1;
+    pending_.erase(pending_.begin(), pending_.lower_bound(nextSequence));
+    nextSequence_.store(nextSequence, std::memory_order_relaxed);
+    readySnapshot_ = std::move(snapshot_);
+    snapshot_.clear();
+    holding_ = true;
+    snapshotReady_.store(true, std::memory_order_release);
+  }
+
+  // Asks for the next chunks of the snapshot being put together, or for a new one. At most one
+  // request per REPLICATION_RESEND_MS unless the last chunks asked for are in.
+  void RequestSnapshot(bool next) {
+    const auto now = Clock::now();
+    if (!next && now - lastSnapshotRequest_ < std::chrono::milliseconds(REPLICATION_RESEND_MS)) {
+      return;
+    }
+    lastSnapshotRequest_ = now;
+    snapshotAsked_ = snapshot_.size() + REPLICATION_SNAPSHOT_WINDOW * REPLICATION_SNAPSHOT_CHUNK;
+    const auto serializedRequest = SerializeObject(
+        ReplicationMessage{.messageType   = ReplicationMessage::MessageType::SNAPSHOT_REQUEST,
+                           .firstSequence = snapshot_.size(),
+                           .lastSequence  = snapshot_.empty() ? 0 : snapshotSequence_,
+                           .orders        = {},
+                           .snapshotBytes = 0,
+                           .snapshot      = {}});
+    sendto(fd_, serializedRequest.data(), serializedRequest.size(), 0,
+           reinterpret_cast<const sockaddr*>(&primary_), primaryLen_);
+  }
+
+  // At most one request per REPLICATION_RESEND_MS, the answer to the last one may be on its way.
+  void RequestResend(std::uint64_t first, std::uint64_t last) {
+    const auto now = Clock::now();
+    if (first == lastRequestFirst_ &&
+        now - lastRequest_ < std::chrono::milliseconds(REPLICATION_RESEND_MS)) {
+      return;
+    }
+    if (first != lastRequestFirst_) {
+      gaps_.fetch_add(1, std::memory_order_relaxed);
+    }
+    lastRequest_      = now;
+    lastRequestFirst_ = first;
+    const auto serializedRequest =
+        SerializeObject(ReplicationMessage{.messageType   = ReplicationMessage::MessageType::RESEND,
+                                           .firstSequence = first,
+                                           .lastSequence  = last,
+                                           .orders        = {},
+                                           .snapshotBytes = 0,
+                                           .snapshot      = {}});
+    sendto(fd_, serializedRequest.data(), serializedRequest.size(), 0,
+           reinterpret_cast<const sockaddr*>(&primary_), primaryLen_);
+    resendRequests_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  addrinfo* addrInfo_ = nullptr;
+  int fd_             = -1;
+  std::unique_ptr<Queue_type> queue_;
+  std::map<std::uint64_t, Order> pending_;  // Received ahead of a missing order.
+  sockaddr_storage primary_{};
+  socklen_t primaryLen_ = 0;
+  Clock::time_point lastRequest_{};
+  std::uint64_t lastRequestFirst_ = 0;
+  std::string snapshot_;  // Put together so far.
+  std::uint64_t snapshotSequence_ = 0;
+  std::size_t snapshotAsked_      = 0;  // Bytes of it asked for so far.
+  Clock::time_point lastSnapshotRequest_{};
+  bool holding_ = false;       // Until the matching thread has taken readySnapshot_.
+  std::string readySnapshot_;  // Handed over by snapshotReady_.
+  std::array<char, REPLICATION_DATAGRAM_SIZE> buffer_;
+  std::atomic<std::uint64_t> nextSequence_    = 1;
+  std::atomic<Clock::rep> lastContact_        = 0;
+  std::atomic<bool> primaryStopped_           = false;
+  std::atomic<bool> inSync_                   = true;
+  std::atomic<bool> stopFlag_                 = false;
+  std::atomic<bool> snapshotReady_            = false;
+  std::atomic<std::uint64_t> appliedOrders_   = 0;
+  std::atomic<std::uint64_t> duplicateOrders_ = 0;
+  std::atomic<std::uint64_t> gaps_            = 0;
+  std::atomic<std::uint64_t> resendRequests_  = 0;
+  std::atomic<std::uint64_t> skippedOrders_   = 0;
+  std::atomic<std::uint64_t> lostOrders_      = 0;
+  std::atomic<std::uint64_t> snapshots_       = 0;
+  std::jthread thread_;
+};
+
+#endif  // #ifndef STANDBY_MANAGER_H
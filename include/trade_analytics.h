@@ -0,0 +1,285 @@
+#ifndef TRADE_ANALYTICS_H
+#define TRADE_ANALYTICS_H
+
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "config.h"
+#include "types.h"
+
+// A copy of every symbol's aggregates, one column per aggregate, so that a scan over all symbols
+// is a plain loop over an array.
+struct TradeAnalyticsSnapshot {
+  std::vector<Symbol_type> symbols;
+  std::vector<std::int64_t> volume;    // Quantity traded.
+  std::vector<std::int64_t> notional;  // Sum of price * quantity.
+  std::vector<std::int64_t> trades;
+  std::vector<std::int64_t> high;      // Prices are 0 until the symbol trades.
+  std::vector<std::int64_t> low;
+  std::vector<std::int64_t> last;
+
+  std::optional<std::size_t> Find(const Symbol_type& symbol) const {
+    const auto it = std::find(symbols.begin(), symbols.end(), symbol);
+    return (it == symbols.end()) ? std::nullopt
+                                 : std::optional<std::size_t>(it - symbols.begin());
+  }
+
+  double Vwap(std::size_t i) const {
+    return (volume[i] == 0) ? 0 : static_cast<double>(notional[i]) / volume[i];
+  }
+
+  std::int64_t TotalVolume() const { return std::reduce(volume.begin(), volume.end()); }
+  std::int64_t TotalNotional() const { return std::reduce(notional.begin(), notional.end()); }
+};
+
+// One time bucket of a symbol's trades.
+struct TradeBar {
+  std::int64_t start    = 0;  // system_clock nanoseconds.
+  std::int64_t open     = 0;
+  std::int64_t high     = 0;
+  std::int64_t low      = 0;
+  std::int64_t close    = 0;
+  std::int64_t volume   = 0;
+  std::int64_t notional = 0;
+  std::int64_t trades   = 0;
+};
+
+// Per symbol trade aggregates (volume, notional and so VWAP, trade count, high, low and last
+// price), plus bars of ANALYTICS_BAR_MS over the last ANALYTICS_BARS buckets. Kept up to date by
+// the matching thread as it produces trades, and readable from any thread without ever making the
+// matching thread wait.
+//
+// Every aggregate is its own array indexed by symbol slot, bars are arrays indexed by slot *
+// ANALYTICS_BARS + bucket. Each symbol has a sequence lock: the matching thread makes the count
+// odd while it updates the symbol and even again once done, and a reader retries its copy of the
+// symbol until it saw the same even count before and after. The arrays are allocated up front for
+// ANALYTICS_MAX_SYMBOLS symbols and never move, trades of symbols beyond that are not counted.
+class TradeAnalytics {
+public:
+  using Clock = std::chrono::system_clock;
+
+  TradeAnalytics() : columns_(std::make_unique<Columns>()) {}
+
+  TradeAnalytics(const TradeAnalytics&)  = delete;
+  void operator=(const TradeAnalytics&) = delete;
+
+  // Matching thread. Adds the trades of one order, all of them in one update of the symbol. Without
+  // now, the clock is read only once a trade is found, so orders that don't trade never read it.
+  template <typename Events_T>
+  void Record(const Symbol_type& symbol, const Events_T& events,
+              std::optional<Clock::time_point> now = std::nullopt) {
+    using Event_T      = typename Events_T::value_type;
+    const auto isTrade = [](const Event_T& event) {
+      return event.eventType == Event_T::EventType::TRADE;
+    };
+    if (std::none_of(events.begin(), events.end(), isTrade)) {
+      return;
+    }
+    const auto slot = Slot(symbol);
+    if (!slot) {
+      return;
+    }
+    auto& c          = *columns_;
+    const auto start = BarStart((now) ? *now : Clock::now());
+    const auto bar   = *slot * ANALYTICS_BARS +
+                     static_cast<std::size_t>(start / BAR_NANOS) % ANALYTICS_BARS;
+
+    BeginWrite(*slot);
+    if (Load(c.barStart[bar]) != start) {
+      Store(c.barStart[bar], start);
+      for (auto* column : {&c.barVolume, &c.barNotional, &c.barTrades}) {
+        Store((*column)[bar], 0);
+      }
+    }
+    for (const auto& event : events) {
+      if (!isTrade(event)) {
+        continue;
+      }
+      const std::int64_t price    = event.price;
+      const std::int64_t quantity = event.quantity;
+      const auto first            = (Load(c.trades[*slot]) == 0);
+      Add(c.volume[*slot], quantity);
+      Add(c.notional[*slot], price * quantity);
+      Add(c.trades[*slot], 1);
+      Store(c.high[*slot], (first) ? price : std::max(Load(c.high[*slot]), price));
+      Store(c.low[*slot], (first) ? price : std::min(Load(c.low[*slot]), price));
+      Store(c.last[*slot], price);
+
+      const auto firstInBar = (Load(c.barTrades[bar]) == 0);
+      if (firstInBar) {
+        Store(c.barOpen[bar], price);
+      }
+      Store(c.barHigh[bar], (firstInBar) ? price : std::max(Load(c.barHigh[bar]), price));
+      Store(c.barLow[bar], (firstInBar) ? price : std::min(Load(c.barLow[bar]), price));
+      Store(c.barClose[bar], price);
+      Add(c.barVolume[bar], quantity);
+      Add(c.barNotional[bar], price * quantity);
+      Add(c.barTrades[bar], 1);
+    }
+    EndWrite(*slot);
+  }
+
+  // Matching thread. Zeroes every aggregate, symbols keep their slots.
+  void Reset() {
+    auto& c               = *columns_;
+    const auto numSymbols = numSymbols_.load(std::memory_order_relaxed);
+    for (std::size_t slot = 0; slot < numSymbols; ++slot) {
+      BeginWrite(slot);
+      for (auto* column : {&c.volume, &c.notional, &c.trades, &c.high, &c.low, &c.last}) {
+        Store((*column)[slot], 0);
+      }
+      for (std::size_t bar = slot * ANALYTICS_BARS; bar < (slot + 1) * ANALYTICS_BARS; ++bar) {
+        Store(c.barStart[bar], 0);
+      }
+      EndWrite(slot);
+    }
+  }
+
+  // Any thread. Each symbol's row is consistent as of the end of some order, rows of different
+  // symbols may be from slightly different moments.
+  TradeAnalyticsSnapshot Snapshot() const {
+    const auto& c         = *columns_;
+    const auto numSymbols = numSymbols_.load(std::memory_order_acquire);
+    TradeAnalyticsSnapshot snapshot;
+    snapshot.symbols.assign(c.symbols.begin(), c.symbols.begin() + numSymbols);
+    for (auto* column : {&snapshot.volume, &snapshot.notional, &snapshot.trades, &snapshot.high,
+                         &snapshot.low, &snapshot.last}) {
+      column->resize(numSymbols);
+    }
+    for (std::size_t slot = 0; slot < numSymbols; ++slot) {
+      Read(slot, [&] {
+        snapshot.volume[slot]   = Load(c.volume[slot]);
+        snapshot.notional[slot] = Load(c.notional[slot]);
+        snapshot.trades[slot]   = Load(c.trades[slot]);
+        snapshot.high[slot]     = Load(c.high[slot]);
+        snapshot.low[slot]      = Load(c.low[slot]);
+        snapshot.last[slot]     = Load(c.last[slot]);
+      });
+    }
+    return snapshot;
+  }
+
+  // Any thread. The symbol's bars over the last ANALYTICS_BARS buckets that had trades, oldest
+  // first.
+  std::vector<TradeBar> Bars(const Symbol_type& symbol,
+                             Clock::time_point now = Clock::now()) const {
+    const auto& c         = *columns_;
+    const auto numSymbols = numSymbols_.load(std::memory_order_acquire);
+    const auto end        = c.symbols.begin() + numSymbols;
+    const auto it         = std::find(c.symbols.begin(), end, symbol);
+    if (it == end) {
+      return {};
+    }
+    const auto slot   = static_cast<std::size_t>(it - c.symbols.begin());
+    const auto oldest = BarStart(now) - static_cast<std::int64_t>(ANALYTICS_BARS - 1) * BAR_NANOS;
+    std::vector<TradeBar> bars;
+    Read(slot, [&] {
+      bars.clear();
+      for (std::size_t bar = slot * ANALYTICS_BARS; bar < (slot + 1) * ANALYTICS_BARS; ++bar) {
+        const auto start = Load(c.barStart[bar]);
+        if (start >= oldest && Load(c.barTrades[bar]) > 0) {
+          bars.push_back({start, Load(c.barOpen[bar]), Load(c.barHigh[bar]), Load(c.barLow[bar]),
+                          Load(c.barClose[bar]), Load(c.barVolume[bar]),
+                          Load(c.barNotional[bar]), Load(c.barTrades[bar])});
+        }
+      }
+    });
+    std::sort(bars.begin(), bars.end(),
+              [](const TradeBar& a, const TradeBar& b) { return a.start < b.start; });
+    return bars;
+  }
+
+private:
+  using Cell_type = std::atomic<std::int64_t>;
+
+  static constexpr std::int64_t BAR_NANOS = ANALYTICS_BAR_MS * 1'000'000;
+
+  template <std::size_t N>
+  using Column_type = std::array<Cell_type, N>;
+
+  struct Columns {
+    static constexpr auto numBars = ANALYTICS_MAX_SYMBOLS * ANALYTICS_BARS;
+
+    std::array<Symbol_type, ANALYTICS_MAX_SYMBOLS> symbols;
+    std::array<std::atomic<std::uint64_t>, ANALYTICS_MAX_SYMBOLS> sequences;
+    Column_type<ANALYTICS_MAX_SYMBOLS> volume, notional, trades, high, low, last;
+    Column_type<numBars> barStart, barOpen, barHigh, barLow, barClose, barVolume, barNotional,
+        barTrades;
+  };
+
+  // Only the matching thread writes, so plain loads and stores of the cells are enough for it,
+  // they are atomic so that readers may look at the same time.
+  static std::int64_t Load(const Cell_type& cell) { return cell.load(std::memory_order_relaxed); }
+  static void Store(Cell_type& cell, std::int64_t value) {
+    cell.store(value, std::memory_order_relaxed);
+  }
+  static void Add(Cell_type& cell, std::int64_t value) { Store(cell, Load(cell) + value); }
+
+  static std::int64_t BarStart(Clock::time_point time) {
+    const auto nanos =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    return nanos - nanos % BAR_NANOS;
+  }
+
+  std::optional<std::size_t> Slot(const Symbol_type& symbol) {
+    const auto it = slots_.find(symbol);
+    if (it != slots_.end()) {
+      return it->second;
+    }
+    const auto slot = numSymbols_.load(std::memory_order_relaxed);
+    if (slot == ANALYTICS_MAX_SYMBOLS) {
+      return std::nullopt;
+    }
+    columns_->symbols[slot] = symbol;
+    slots_.emplace(symbol, slot);
+    numSymbols_.store(slot + 1, std::memory_order_release);  // Publishes the name.
+    return slot;
+  }
+
+  void BeginWrite(std::size_t slot) {
+    auto& sequence = columns_->sequences[slot];
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void EndWrite(std::size_t slot) {
+    auto& sequence = columns_->sequences[slot];
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  template <typename F>
+  void Read(std::size_t slot, F&& read) const {
+    const auto& sequence = columns_->sequences[slot];
+    while (true) {
+      const auto before = sequence.load(std::memory_order_acquire);
+      if (before % 2 == 1) {
+        continue;
+      }
+      read();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == before) {
+        return;
+      }
+    }
+  }
+
+  std::unique_ptr<Columns> columns_;
+  std::atomic<std::size_t> numSymbols_ = 0;
+  std::unordered_map<Symbol_type, std::size_t> slots_;  // Matching thread only.
+};
+
+#endif  // #ifndef TRADE_ANALYTICS_H
@@ -0,0 +1,22 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+/////////////////
+/// std
+/////////////////
+#include <string>
+
+// Defining types
+using UserId_type      = int;
+using Symbol_type      = std::string;
+using OrderId_type     = int;
+using Price_type       = int;
+using Quantity_type    = int;
+using UserOrderId_type = int;
+
+enum class Side : char {
+  BUY,
+  SELL
+};
+
+#endif  // #ifndef TYPES_H
@@ -0,0 +1,212 @@
+/////////////////
+/// std
+/////////////////
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "load_generator.h"
+#include "order_book.h"
+
+struct BenchArgs {
+  std::size_t numOrders      = 1'000'000;
+  std::size_t repeats        = 5;  // Best of, to keep noise out of the comparison.
+  std::string baselineFile   = ROOT_DIR + "/test/bench_baseline.csv";
+  double throughputTolerance = 0.15;  // Largest allowed drop in throughput, as a fraction.
+  double latencyTolerance    = 0.30;  // Largest allowed rise in p99 latency, as a fraction.
+  bool updateBaseline        = false;
+};
+
+struct BenchResult {
+  double ordersPerSecond = 0;
+  double p99Nanos        = 0;
+};
+
+void PrintUsage() {
+  std::cout << "Usage: OrderBook_Bench [options]\n"
+               "  --orders <n>                Orders per run (default 1000000).\n"
+               "  --repeats <n>               Runs per policy, the best one counts (default 5).\n"
+               "  --baseline <file>           Baseline to compare against (default "
+               "test/bench_baseline.csv).\n"
+               "  --throughput-tolerance <f>  Allowed drop in throughput (default 0.15).\n"
+               "  --latency-tolerance <f>     Allowed rise in p99 latency (default 0.30).\n"
+               "  --update-baseline           Write the results to the baseline instead.\n";
+}
+
+BenchArgs ParseArgs(int argc, char** argv) {
+  BenchArgs args;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--update-baseline") {
+      args.updateBaseline = true;
+      continue;
+    }
+    if (arg == "--help" || i + 1 == argc) {
+      PrintUsage();
+      std::exit(arg == "--help" ? 0 : 1);
+    }
+    const std::string value = argv[++i];
+    if (arg == "--orders") {
+      args.numOrders = std::stoul(value);
+    } else if (arg == "--repeats") {
+      args.repeats = std::stoul(value);
+    } else if (arg == "--baseline") {
+      args.baselineFile = value;
+    } else if (arg == "--throughput-tolerance") {
+      args.throughputTolerance = std::stod(value);
+    } else if (arg == "--latency-tolerance") {
+      args.latencyTolerance = std::stod(value);
+    } else {
+      PrintUsage();
+      std::exit(1);
+    }
+  }
+  return args;
+}
+
+// The same flow the load generator sends, from eight users, fixed so that runs are comparable.
+std::vector<Order> MakeOrders(std::size_t numOrders) {
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{}, 8, 1e-4, 1);
+  std::vector<Order> orders(numOrders);
+  std::generate(orders.begin(), orders.end(), [&] { return orderFlow.Next(); });
+  return orders;
+}
+
+// Throughput is measured the way the server matches, through HandleOrders() in batches. Latency is
+// measured in a second, separate run, timing every HandleOrder() call on its own.
+template <typename Policy>
+BenchResult RunOnce(const std::vector<Order>& orders) {
+  using Clock = std::chrono::steady_clock;
+  BenchResult result;
+  std::size_t numEvents = 0;
+  {
+    auto batch = orders;
+    BasicOrderBooks<Policy> books;
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < batch.size(); i += INGEST_BATCH_SIZE) {
+      const auto count = std::min(INGEST_BATCH_SIZE, batch.size() - i);
+      books.HandleOrders(std::span<Order>(batch).subspan(i, count),
+                         [&](std::size_t, std::optional<std::vector<Event>>&& events) {
+                           numEvents += (events) ? events->size() : 0;
+                         });
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    result.ordersPerSecond = static_cast<double>(orders.size()) / elapsed.count();
+  }
+  {
+    auto copies = orders;
+    BasicOrderBooks<Policy> books;
+    std::vector<Clock::duration> latencies;
+    latencies.reserve(copies.size());
+    for (auto& order : copies) {
+      const auto start  = Clock::now();
+      const auto events = books.HandleOrder(std::move(order));
+      latencies.push_back(Clock::now() - start);
+      numEvents += (events) ? events->size() : 0;
+    }
+    const auto p99 = latencies.begin() + static_cast<std::ptrdiff_t>(latencies.size() * 99 / 100);
+    std::nth_element(latencies.begin(), p99, latencies.end());
+    result.p99Nanos = std::chrono::duration<double, std::nano>(*p99).count();
+  }
+  if (numEvents == 0) {
+    throw std::runtime_error("The benchmark produced no events.");
+  }
+  return result;
+}
+
+// Lines of "policy,orders_per_second,p99_ns", after a header.
+std::map<std::string, BenchResult> ReadBaseline(const std::string& fileName) {
+  std::map<std::string, BenchResult> baseline;
+  std::ifstream file(fileName);
+  if (!file) {
+    throw std::runtime_error("No baseline at " + fileName +
+                             ", record one on this machine with --update-baseline.");
+  }
+  std::string line;
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    std::stringstream stream(line);
+    std::string policy, ordersPerSecond, p99Nanos;
+    if (std::getline(stream, policy, ',') && std::getline(stream, ordersPerSecond, ',') &&
+        std::getline(stream, p99Nanos)) {
+      baseline[policy] = {std::stod(ordersPerSecond), std::stod(p99Nanos)};
+    }
+  }
+  return baseline;
+}
+
+void WriteBaseline(const std::string& fileName,
+                   const std::vector<std::pair<std::string, BenchResult>>& results) {
+  std::ofstream file(fileName);
+  if (!file) {
+    throw std::runtime_error("Error opening " + fileName + " for writing.");
+  }
+  file << "policy,orders_per_second,p99_ns\n" << std::fixed << std::setprecision(0);
+  for (const auto& [policy, result] : results) {
+    file << policy << ',' << result.ordersPerSecond << ',' << result.p99Nanos << '\n';
+  }
+}
+
+// Exits with 1 if any policy's throughput dropped, or its p99 latency rose, by more than the
+// tolerance against the baseline. Baselines are machine specific, record one with
+// --update-baseline on the machine the comparison runs on.
+int main(int argc, char** argv) {
+  const auto args = ParseArgs(argc, argv);
+  // Before the runs, so a missing baseline fails straight away.
+  const auto baseline =
+      (args.updateBaseline) ? std::map<std::string, BenchResult>{} : ReadBaseline(args.baselineFile);
+  const auto orders = MakeOrders(args.numOrders);
+
+  std::vector<std::pair<std::string, BenchResult>> results;
+  ForEachPolicy([&]<typename Policy>(const std::string& name) {
+    BenchResult best{0, std::numeric_limits<double>::max()};
+    for (std::size_t i = 0; i < args.repeats; ++i) {
+      const auto result    = RunOnce<Policy>(orders);
+      best.ordersPerSecond = std::max(best.ordersPerSecond, result.ordersPerSecond);
+      best.p99Nanos        = std::min(best.p99Nanos, result.p99Nanos);
+    }
+    results.emplace_back(name, best);
+  });
+
+  if (args.updateBaseline) {
+    WriteBaseline(args.baselineFile, results);
+    std::cout << "Baseline written to " << args.baselineFile << '\n';
+    return 0;
+  }
+
+  bool regressed = false;
+  std::cout << std::fixed << std::setprecision(0);
+  for (const auto& [policy, result] : results) {
+    std::cout << std::left << std::setw(16) << policy << std::right << std::setw(12)
+              << result.ordersPerSecond << " orders/s, p99 " << std::setw(6) << result.p99Nanos
+              << " ns";
+    const auto it = baseline.find(policy);
+    if (it == baseline.end()) {
+      std::cout << "  (no baseline)\n";
+      continue;
+    }
+    const auto& base            = it->second;
+    const auto throughputChange = result.ordersPerSecond / base.ordersPerSecond - 1;
+    const auto latencyChange    = result.p99Nanos / base.p99Nanos - 1;
+    const auto policyRegressed  = (throughputChange < -args.throughputTolerance ||
+                                  latencyChange > args.latencyTolerance);
+    regressed                   = regressed || policyRegressed;
+    std::cout << std::showpos << "  throughput " << throughputChange * 100 << "%, p99 "
+              << latencyChange * 100 << "%" << std::noshowpos
+              << ((policyRegressed) ? "  REGRESSION\n" : "\n");
+  }
+  return (regressed) ? 1 : 0;
+}
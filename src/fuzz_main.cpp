@@ -0,0 +1,74 @@
+/////////////////
+/// std
+/////////////////
+#include <iostream>
+#include <string>
+#include <string_view>
+
+/////////////////
+/// local
+/////////////////
+#include "differential_fuzzer.h"
+
+struct FuzzArgs {
+  std::size_t numOrders = 1'000'000;  // Per seed and policy.
+  std::uint64_t seed    = 1;
+  std::size_t numSeeds  = 4;
+  std::string policy    = "all";
+};
+
+void PrintUsage() {
+  std::cout << "Usage: OrderBook_Fuzz [options]\n"
+               "  --orders <n>     Orders per seed and policy (default 1000000).\n"
+               "  --seed <n>       First seed (default 1).\n"
+               "  --seeds <n>      Number of seeds, each with its own order flow (default 4).\n"
+               "  --policy <name>  Only fuzz this policy, e.g. Ladder (default all).\n";
+}
+
+FuzzArgs ParseArgs(int argc, char** argv) {
+  FuzzArgs args;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--help" || i + 1 == argc) {
+      PrintUsage();
+      std::exit(arg == "--help" ? 0 : 1);
+    }
+    const std::string value = argv[++i];
+    if (arg == "--orders") {
+      args.numOrders = std::stoul(value);
+    } else if (arg == "--seed") {
+      args.seed = std::stoull(value);
+    } else if (arg == "--seeds") {
+      args.numSeeds = std::stoul(value);
+    } else if (arg == "--policy") {
+      args.policy = value;
+    } else {
+      PrintUsage();
+      std::exit(1);
+    }
+  }
+  return args;
+}
+
+// Exits with 1 on the first disagreement, printing the order and both event streams. Rerunning
+// with the reported seed and policy reproduces it.
+int main(int argc, char** argv) {
+  const auto args = ParseArgs(argc, argv);
+  bool failed     = false;
+  ForEachPolicy([&]<typename Policy>(const std::string& name) {
+    if (failed || (args.policy != "all" && args.policy != name)) {
+      return;
+    }
+    for (auto seed = args.seed; seed < args.seed + args.numSeeds && !failed; ++seed) {
+      FuzzConfig config;
+      config.orderFlow    = FuzzOrderFlow(seed);
+      config.numOrders    = args.numOrders;
+      config.seed         = seed;
+      const auto mismatch = FuzzAgainstReference<Policy>(config);
+      failed              = mismatch.has_value();
+      std::cout << name << ", seed " << seed << ": "
+                << ((failed) ? "MISMATCH\n" + to_string(*mismatch) : "ok") << std::endl;
+    }
+  });
+  return (failed) ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+/////////////////
+/// std
+/////////////////
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+/////////////////
+/// local
+/////////////////
+#include "load_generator.h"
+
+void PrintUsage() {
+  std::cout
+      << "Usage: OrderBook_LoadGen [options]\n"
+         "  --rate <orders/s>          Target rate over all threads (default 100000).\n"
+         "  --threads <n>              Sending threads, each with its own socket (default 4).\n"
+         "  --duration <seconds>       How long to send for (default 10).\n"
+         "  --symbols <A,B,...>        Symbols to trade (default AAPL,IBM,MSFT,TSLA).\n"
+         "  --price <ticks>            Starting mid price (default 1000).\n"
+         "  --depth <ticks>            Passive orders rest within this many ticks of mid (default "
+         "10).\n"
+         "  --walk <probability>       Chance mid moves a tick per order (default 0.05).\n"
+         "  --max-quantity <n>         Largest order quantity (default 100).\n"
+         "  --mix <add:cancel:aggress> Relative weights of each kind of order (default 6:3:1).\n"
+         "  --seed <n>                 Random seed (default 1).\n"
+         "  --flush                    Send FLUSH at the end so the server writes its log.\n";
+}
+
+std::vector<std::string> Split(const std::string& str, char delimiter) {
+  std::vector<std::string> tokens;
+  std::stringstream stream(str);
+  for (std::string token; std::getline(stream, token, delimiter);) {
+    tokens.push_back(token);
+  }
+  return tokens;
+}
+
+LoadGeneratorConfig ParseArgs(int argc, char** argv) {
+  LoadGeneratorConfig config;
+  auto& orderFlow = config.orderFlow;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--flush") {
+      config.flush = true;
+      continue;
+    }
+    if (arg == "--help" || i + 1 == argc) {
+      PrintUsage();
+      std::exit(arg == "--help" ? 0 : 1);
+    }
+    const std::string value = argv[++i];
+    if (arg == "--rate") {
+      config.rate = std::stod(value);
+    } else if (arg == "--threads") {
+      const auto numThreads = std::stol(value);
+      config.numThreads     = (numThreads > 0) ? static_cast<std::size_t>(numThreads) : 0;
+    } else if (arg == "--duration") {
+      config.duration = std::chrono::duration<double>(std::stod(value));
+    } else if (arg == "--symbols") {
+      orderFlow.symbols = Split(value, ',');
+    } else if (arg == "--price") {
+      orderFlow.startPrice = std::stoi(value);
+    } else if (arg == "--depth") {
+      orderFlow.depth = std::stoi(value);
+    } else if (arg == "--walk") {
+      orderFlow.walkProbability = std::stod(value);
+    } else if (arg == "--max-quantity") {
+      orderFlow.maxQuantity = std::stoi(value);
+    } else if (arg == "--mix") {
+      const auto weights = Split(value, ':');
+      if (weights.size() != 3) {
+        PrintUsage();
+        std::exit(1);
+      }
+      orderFlow.addWeight     = std::stod(weights[0]);
+      orderFlow.cancelWeight  = std::stod(weights[1]);
+      orderFlow.aggressWeight = std::stod(weights[2]);
+    } else if (arg == "--seed") {
+      config.seed = std::stoull(value);
+    } else {
+      PrintUsage();
+      std::exit(1);
+    }
+  }
+  if (!(config.rate > 0) || config.numThreads == 0 || config.duration.count() < 0 ||
+      orderFlow.symbols.empty() || orderFlow.maxQuantity < 1) {
+    PrintUsage();
+    std::exit(1);
+  }
+  return config;
+}
+
+int main(int argc, char** argv) {
+  const auto config = ParseArgs(argc, argv);
+  const auto result = LoadGenerator(config).Run();
+
+  const auto achievedRate = static_cast<double>(result.sent) / result.elapsed.count();
+  std::cout << "Target rate:   " << config.rate << " orders/s\n"
+            << "Achieved rate: " << achievedRate << " orders/s (" << result.sent << " sent in "
+            << result.elapsed.count() << " s)\n"
+            << "Send errors:   " << result.sendErrors << '\n'
+            << "Acknowledged:  " << result.acked << " (" << result.sent - result.acked
+            << " without an execution report)\n"
+            << "Rejected:      " << result.rejected << '\n';
+
+  const auto& latencies = result.latencies;
+  if (latencies.empty()) {
+    std::cout << "No execution reports received, no round trip latencies.\n";
+    return 0;
+  }
+  const auto percentile = [&](double p) {
+    const auto index = static_cast<std::size_t>(p / 100.0 * static_cast<double>(latencies.size() - 1));
+    return std::chrono::duration<double, std::micro>(latencies[index]).count();
+  };
+  std::cout << "Round trip (us): p50 " << percentile(50) << ", p90 " << percentile(90) << ", p99 "
+            << percentile(99) << ", p99.9 " << percentile(99.9) << ", max " << percentile(100)
+            << '\n';
+}
@@ -0,0 +1,147 @@
+/////////////////
+/// std
+/////////////////
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/////////////////
+/// local
+/////////////////
+#include "capture.h"
+#include "load_generator.h"
+#include "order_book.h"
+#include "socket_wrappers.h"
+
+struct ReplayArgs {
+  std::string fileName;
+  std::string host;  // Send to the server on this host, rather than replaying in process.
+  double speed = 0;  // Multiple of the original pacing, 0 for as fast as possible.
+};
+
+void PrintUsage() {
+  std::cout << "Usage: OrderBook_Replay --file <capture> [options]\n"
+               "  --file <capture>  Capture recorded with OrderBook_Server --capture.\n"
+               "  --send <host>     Send the orders to the server on this host, instead of\n"
+               "                    matching them in process.\n"
+               "  --speed <x>       Replay at x times the original pace, 0 for as fast as\n"
+               "                    possible (default 0).\n";
+}
+
+ReplayArgs ParseArgs(int argc, char** argv) {
+  ReplayArgs args;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--help" || i + 1 == argc) {
+      PrintUsage();
+      std::exit(arg == "--help" ? 0 : 1);
+    }
+    const std::string value = argv[++i];
+    if (arg == "--file") {
+      args.fileName = value;
+    } else if (arg == "--send") {
+      args.host = value;
+    } else if (arg == "--speed") {
+      args.speed = std::stod(value);
+    } else {
+      PrintUsage();
+      std::exit(1);
+    }
+  }
+  if (args.fileName.empty() || args.speed < 0) {
+    PrintUsage();
+    std::exit(1);
+  }
+  return args;
+}
+
+// When the order should go out, relative to start: its arrival relative to the first order's,
+// divided by the speed.
+class Pacer {
+public:
+  explicit Pacer(double speed) : speed_(speed) {}
+
+  void Wait(std::int64_t timestamp) {
+    if (speed_ == 0) {
+      return;
+    }
+    if (!started_) {
+      started_ = true;
+      first_   = timestamp;
+      start_   = std::chrono::steady_clock::now();
+    }
+    WaitUntil(start_ + std::chrono::nanoseconds(static_cast<std::int64_t>(
+                           static_cast<double>(timestamp - first_) / speed_)));
+  }
+
+private:
+  double speed_;
+  bool started_       = false;
+  std::int64_t first_ = 0;  // Timestamp of the first order.
+  std::chrono::steady_clock::time_point start_;
+};
+
+int main(int argc, char** argv) {
+  const auto args = ParseArgs(argc, argv);
+  CaptureReader reader(args.fileName);
+  Pacer pacer(args.speed);
+
+  std::uint64_t numOrders  = 0;
+  std::uint64_t numEvents  = 0;
+  std::uint64_t sendErrors = 0;
+  std::vector<CapturedOrder> block;
+  std::vector<Order> orders;
+  const auto start = std::chrono::steady_clock::now();
+  if (args.host.empty()) {
+    OrderBooks orderBooks;
+    auto count = [&](std::size_t, std::optional<std::vector<Event>>&& events) {
+      numEvents += (events) ? events->size() : 0;
+    };
+    while (reader.Next(block)) {
+      numOrders += block.size();
+      if (args.speed == 0) {
+        orders.clear();
+        for (auto& captured : block) {
+          orders.push_back(std::move(captured.order));
+        }
+        orderBooks.HandleOrders(orders, count);
+        continue;
+      }
+      for (auto& captured : block) {
+        pacer.Wait(captured.timestamp);
+        count(0, orderBooks.HandleOrder(std::move(captured.order)));
+      }
+    }
+  } else {
+    addrinfo* addrInfo = nullptr;
+    int fd             = -1;
+    SetAddrInfo(&addrInfo, args.host.c_str(), PORT);
+    SetSocket(addrInfo, fd);
+    while (reader.Next(block)) {
+      numOrders += block.size();
+      for (const auto& captured : block) {
+        pacer.Wait(captured.timestamp);
+        const auto serializedOrder = SerializeObject(captured.order);
+        if (sendto(fd, serializedOrder.data(), serializedOrder.size(), 0, addrInfo->ai_addr,
+                   addrInfo->ai_addrlen) < 0) {
+          ++sendErrors;
+        }
+      }
+    }
+    freeaddrinfo(addrInfo);
+    close(fd);
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "Replayed:    " << numOrders << " orders in " << elapsed.count() << " s ("
+            << static_cast<double>(numOrders) / elapsed.count() << " orders/s)\n";
+  if (args.host.empty()) {
+    std::cout << "Events:      " << numEvents << '\n';
+  } else {
+    std::cout << "Send errors: " << sendErrors << '\n';
+  }
+}
@@ -1,8 +1,69 @@
+/////////////////
+/// std
+/////////////////
+#include <iostream>
+#include <string>
+#include <string_view>
+
 /////////////////
 /// local
 /////////////////
 #include "server_manager.h"
 
-int main() {
-  auto& serverManager = ServerManager::GetServerManager();
+void PrintUsage() {
+  std::cout << "Usage: OrderBook_Server [options]\n"
+               "  --standby-host <host>      Replicate every order to a standby on this host.\n"
+               "  --standby                  Run as a standby, take over if the primary goes "
+               "silent.\n"
+               "  --replication-port <port>  Port the standby listens on (default " REPLICATION_PORT
+               ").\n"
+               "  --capture <file>           Record every order applied to the books.\n"
+               "  --capture-compress         zlib compress the capture.\n"
+               "  --max-resting-orders <n>   Resting orders per book (default " +
+                   std::to_string(BOOK_MAX_RESTING_ORDERS) + ").\n"
+               "  --max-levels <n>           Price levels per side of a book (default " +
+                   std::to_string(BOOK_MAX_LEVELS) + ").\n"
+               "  --max-queued-events <n>    Server log events not yet written (default " +
+                   std::to_string(SERVER_MAX_QUEUED_EVENTS) + ").\n";
+}
+
+ServerConfig ParseArgs(int argc, char** argv) {
+  ServerConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--standby") {
+      config.standby = true;
+      continue;
+    }
+    if (arg == "--capture-compress") {
+      config.captureCompress = true;
+      continue;
+    }
+    if (arg == "--help" || i + 1 == argc) {
+      PrintUsage();
+      std::exit(arg == "--help" ? 0 : 1);
+    }
+    const std::string value = argv[++i];
+    if (arg == "--standby-host") {
+      config.standbyHost = value;
+    } else if (arg == "--replication-port") {
+      config.replicationPort = value;
+    } else if (arg == "--capture") {
+      config.captureFile = value;
+    } else if (arg == "--max-resting-orders") {
+      config.bookLimits.maxRestingOrders = std::stoul(value);
+    } else if (arg == "--max-levels") {
+      config.bookLimits.maxLevels = std::stoul(value);
+    } else if (arg == "--max-queued-events") {
+      config.maxQueuedEvents = std::stoul(value);
+    } else {
+      PrintUsage();
+      std::exit(1);
+    }
+  }
+  return config;
+}
+
+int main(int argc, char** argv) {
+  auto& serverManager = ServerManager::GetServerManager(ParseArgs(argc, argv));
 }
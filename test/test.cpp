@@ -6,6 +6,13 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <set>
+
 /////////////////
 /// gtest
 /////////////////
@@ -14,13 +21,32 @@
 /////////////////
 /// local
 /////////////////
+#include "capture.h"
 #include "client_manager.h"
+#include "differential_fuzzer.h"
+#include "load_generator.h"
+#include "log_manager.h"
+#include "replication_manager.h"
 #include "scenario.h"
 #include "server_manager.h"
+#include "standby_manager.h"
 
 static const auto scenarios       = GetScenarios(ROOT_DIR + "/data/inputfile.csv");
 static const auto expectedOutputs = GetExpectedOutput(ROOT_DIR + "/data/outputfile.csv");
 
+// An order on IBM, for the tests that build their own.
+Order MakeOrder(Order::OrderType orderType, UserId_type userId, UserOrderId_type userOrderId = 1,
+                Price_type price = 10, Quantity_type quantity = 100) {
+  Order order;
+  order.orderType   = orderType;
+  order.userId      = userId;
+  order.userOrderId = userOrderId;
+  order.symbol      = "IBM";
+  order.price       = price;
+  order.quantity    = quantity;
+  return order;
+}
+
 struct PerfTool {
   PerfTool() {
     const auto peConfigsSize = peConfigs.size();
@@ -116,3 +142,1046 @@ TEST(OrderBook, Scenario13) { TestScenario(13); }
 TEST(OrderBook, Scenario14) { TestScenario(14); }
 TEST(OrderBook, Scenario15) { TestScenario(15); }
 TEST(OrderBook, Scenario16) { TestScenario(16); }
+
+// The log lines one order produces.
+std::vector<std::string> HandleLog(OrderBooks& orderBooks, Order::OrderType orderType,
+                                   UserId_type userId, UserOrderId_type userOrderId,
+                                   Price_type price, Quantity_type quantity) {
+  std::vector<std::string> log;
+  if (const auto events =
+          orderBooks.HandleOrder(MakeOrder(orderType, userId, userOrderId, price, quantity))) {
+    for (const auto& event : *events) {
+      log.push_back(to_string(event));
+    }
+  }
+  return log;
+}
+
+TEST(OrderBook, PartialFillReducesRestingOrder) {
+  OrderBooks orderBooks;
+  HandleLog(orderBooks, Order::OrderType::SELL, 1, 1, 10, 100);
+  HandleLog(orderBooks, Order::OrderType::BUY, 2, 2, 10, 30);
+  // Only 70 of the sell are left for a market buy of 100.
+  const std::vector<std::string> expected = {"A, 3, 3", "T, 3, 3, 1, 1, 10, 70", "B, S, -, -"};
+  EXPECT_EQ(HandleLog(orderBooks, Order::OrderType::BUY, 3, 3, 0, 100), expected);
+}
+
+TEST(OrderBook, CancelReducesLevelQuantity) {
+  OrderBooks orderBooks;
+  HandleLog(orderBooks, Order::OrderType::SELL, 1, 1, 10, 100);
+  HandleLog(orderBooks, Order::OrderType::CANCEL, 1, 1, -1, -1);
+  // The emptied level is passed over rather than matched forever, and the buy rests.
+  const auto log = HandleLog(orderBooks, Order::OrderType::BUY, 2, 3, 11, 50);
+  EXPECT_EQ(log.front(), "A, 2, 3");
+  EXPECT_EQ(log.back(), "B, B, 11, 50");
+}
+
+TEST(OrderBook, PriceLevelsPerSide) {
+  OrderBooks orderBooks;
+  HandleLog(orderBooks, Order::OrderType::BUY, 1, 1, 10, 100);
+  HandleLog(orderBooks, Order::OrderType::SELL, 2, 2, 10, 100);
+  // The buy level at 10 is empty now, a sell at 10 must not join it.
+  const std::vector<std::string> rests = {"A, 3, 3", "B, S, 10, 50"};
+  EXPECT_EQ(HandleLog(orderBooks, Order::OrderType::SELL, 3, 3, 10, 50), rests);
+  const std::vector<std::string> trades = {"A, 4, 4", "T, 4, 4, 3, 3, 10, 50", "B, S, -, -"};
+  EXPECT_EQ(HandleLog(orderBooks, Order::OrderType::BUY, 4, 4, 10, 50), trades);
+}
+
+// An order skips its own user's resting orders, and stops at a level holding only those.
+TEST(OrderBook, StopsAtOwnOrders) {
+  OrderBooks orderBooks;
+  HandleLog(orderBooks, Order::OrderType::SELL, 1, 1, 10, 100);
+  // Rests through its own sell, the book is crossed.
+  const std::vector<std::string> rests = {"A, 1, 2", "B, S, 10, 100", "B, B, 11, 50"};
+  EXPECT_EQ(HandleLog(orderBooks, Order::OrderType::BUY, 1, 2, 11, 50), rests);
+  // Other users trade with both sides.
+  const std::vector<std::string> buy = {"A, 2, 3", "T, 2, 3, 1, 1, 10, 30", "B, S, 10, 70"};
+  EXPECT_EQ(HandleLog(orderBooks, Order::OrderType::BUY, 2, 3, 10, 30), buy);
+  const std::vector<std::string> sell = {"A, 2, 4", "T, 1, 2, 2, 4, 11, 20", "B, B, 11, 30"};
+  EXPECT_EQ(HandleLog(orderBooks, Order::OrderType::SELL, 2, 4, 11, 20), sell);
+}
+
+// Every level container must produce exactly the log the original tree-based book did.
+template <typename Policy>
+class OrderBookPolicy : public ::testing::Test {};
+
+using Policies = ::testing::Types<TreePolicy, FlatPolicy, LadderPolicy, PooledTreePolicy,
+                                  PooledLadderPolicy, FixedPointTreePolicy>;
+TYPED_TEST_SUITE(OrderBookPolicy, Policies);
+
+TYPED_TEST(OrderBookPolicy, Scenarios) {
+  for (const auto& [id, scenario] : scenarios) {
+    OrderBooks orderBooks;
+    orderBooks.SetDefaultPolicy<TypeParam>();
+    std::vector<std::string> log;
+    for (const auto& order : scenario.orders) {
+      if (const auto events = orderBooks.HandleOrder(order)) {
+        for (const auto& event : *events) {
+          log.push_back(to_string(event));
+        }
+      }
+    }
+    EXPECT_EQ(log, expectedOutputs.at(id)) << "Scenario " << id;
+  }
+}
+
+// A short run of OrderBook_Fuzz.
+TYPED_TEST(OrderBookPolicy, MatchesReference) {
+  for (std::uint64_t seed = 1; seed <= 2; ++seed) {
+    FuzzConfig config;
+    config.orderFlow    = FuzzOrderFlow(seed);
+    config.numOrders    = 100'000;
+    config.seed         = seed;
+    const auto mismatch = FuzzAgainstReference<TypeParam>(config);
+    EXPECT_FALSE(mismatch.has_value()) << "Seed " << seed << "\n" << to_string(*mismatch);
+  }
+}
+
+// Batches through HandleOrders() give the same events as one HandleOrder() per order, also with
+// FLUSHes in the middle of a batch.
+TYPED_TEST(OrderBookPolicy, BatchedMatchesSequential) {
+  static constexpr std::size_t batchSize = 64;
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{.symbols = {"AAPL", "IBM"}}, 4, 0, 1);
+  std::vector<Order> orders;
+  for (std::size_t i = 0; i < 20'000; ++i) {
+    orders.push_back(orderFlow.Next());
+    if (i % 5'000 == 37) {
+      orders.back().orderType = Order::OrderType::FLUSH;
+    }
+  }
+
+  BasicOrderBooks<TypeParam> sequential;
+  std::vector<std::optional<std::vector<Event>>> expected;
+  for (const auto& order : orders) {
+    expected.push_back(sequential.HandleOrder(order));
+  }
+
+  BasicOrderBooks<TypeParam> batched;
+  std::vector<std::optional<std::vector<Event>>> actual(orders.size());
+  auto batch = orders;
+  for (std::size_t begin = 0; begin < batch.size(); begin += batchSize) {
+    const auto size = std::min(batchSize, batch.size() - begin);
+    batched.HandleOrders(std::span<Order>(batch).subspan(begin, size),
+                         [&](std::size_t i, std::optional<std::vector<Event>>&& events) {
+                           actual[begin + i] = std::move(events);
+                         });
+  }
+  for (std::size_t i = 0; i < orders.size(); ++i) {
+    ASSERT_EQ(actual[i], expected[i]) << "Order " << i << ": " << to_string(orders[i]);
+  }
+}
+
+// Books loaded from a snapshot, sent through cereal, go on to match exactly like the originals.
+TYPED_TEST(OrderBookPolicy, SnapshotRestoresBooks) {
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{.symbols = {"AAPL", "IBM"}}, 4, 0, 2);
+  BasicOrderBooks<TypeParam> original;
+  for (std::size_t i = 0; i < 10'000; ++i) {
+    original.HandleOrder(orderFlow.Next());
+  }
+
+  const auto bytes = SerializeObject(original.Snapshot());
+  OrderBooksSnapshot snapshot;
+  DeserializeObject(snapshot, bytes.data(), bytes.size());
+  BasicOrderBooks<TypeParam> restored;
+  restored.HandleOrder(orderFlow.Next());  // Replaced by the snapshot.
+  restored.LoadSnapshot(snapshot);
+  EXPECT_EQ(restored.GetMemoryStats().orderIdMap.elements,
+            original.GetMemoryStats().orderIdMap.elements);
+
+  for (std::size_t i = 0; i < 10'000; ++i) {
+    const auto order = orderFlow.Next();
+    ASSERT_EQ(restored.HandleOrder(order), original.HandleOrder(order)) << to_string(order);
+  }
+}
+
+// Orders that take whole levels, with one of the taker's own orders in the way.
+TYPED_TEST(OrderBookPolicy, TakesWholeLevels) {
+  BasicOrderBooks<TypeParam> orderBooks;
+  ReferenceOrderBooks reference;
+  std::vector<Order> orders;
+  UserOrderId_type userOrderId = 0;
+  auto add = [&](Order::OrderType orderType, UserId_type userId, Price_type price,
+                 Quantity_type quantity) {
+    orders.push_back(MakeOrder(orderType, userId, ++userOrderId, price, quantity));
+  };
+  for (Price_type price = 10; price < 15; ++price) {
+    for (UserId_type userId = 1; userId <= 3; ++userId) {
+      add(Order::OrderType::BUY, userId, price, 10 * userId);
+      add(Order::OrderType::SELL, userId, price + 10, 10 * userId);
+    }
+  }
+  add(Order::OrderType::SELL, 9, 23, 5);
+  add(Order::OrderType::BUY, 9, 0, 1000);   // Market buy, stopped by its own order at 23.
+  add(Order::OrderType::BUY, 4, 24, 65);    // Takes that order, then all of 24.
+  add(Order::OrderType::SELL, 4, 1, 130);   // Takes two buy levels and part of a third.
+  add(Order::OrderType::SELL, 5, 0, 1000);  // Market sell, takes the rest.
+  for (const auto& order : orders) {
+    const auto expected = reference.HandleOrder(order);
+    const auto actual   = orderBooks.HandleOrder(order);
+    ASSERT_EQ(actual, expected) << to_string(order);
+  }
+}
+
+// Levels emptied by trades and cancels, at the top of book and below it, are dropped.
+TYPED_TEST(OrderBookPolicy, ErasesEmptyLevels) {
+  BasicOrderBooks<TypeParam> orderBooks;
+  ReferenceOrderBooks reference;
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{.symbols = {"IBM"}}, 4, 0, 1);
+  std::vector<Order> orders;
+  for (std::size_t i = 0; i < 10'000; ++i) {
+    orders.push_back(orderFlow.Next());
+  }
+  // Cancel whatever still rests, in an order unrelated to price.
+  const auto lastId =
+      std::max_element(orders.begin(), orders.end(), [](const Order& a, const Order& b) {
+        return a.userOrderId < b.userOrderId;
+      })->userOrderId;
+  std::vector<UserOrderId_type> ids(lastId);
+  std::iota(ids.begin(), ids.end(), 1);
+  std::shuffle(ids.begin(), ids.end(), std::mt19937_64(1));
+  for (const auto id : ids) {
+    orders.push_back(MakeOrder(Order::OrderType::CANCEL, 1, id));
+  }
+  for (const auto& order : orders) {
+    ASSERT_EQ(orderBooks.HandleOrder(order), reference.HandleOrder(order)) << to_string(order);
+  }
+  const auto stats = orderBooks.GetMemoryStats();
+  ASSERT_EQ(stats.books.size(), 1u);
+  EXPECT_EQ(stats.books[0].orders.elements, 0u);
+  EXPECT_EQ(stats.books[0].buyLevels.elements, 0u);
+  EXPECT_EQ(stats.books[0].sellLevels.elements, 0u);
+  EXPECT_GT(stats.books[0].buyLevels.highWaterElements, 0u);
+  EXPECT_EQ(stats.orderIdMap.elements, 0u);
+  EXPECT_GT(stats.orderIdMap.highWaterElements, 0u);
+}
+
+// A price the levels can't hold is rejected, rather than thrown on by the ladder.
+TYPED_TEST(OrderBookPolicy, RejectsFarPrice) {
+  BasicOrderBooks<TypeParam> orderBooks;
+  auto buy = [&](UserOrderId_type userOrderId, Price_type price) {
+    return *orderBooks.HandleOrder(MakeOrder(Order::OrderType::BUY, 1, userOrderId, price));
+  };
+  buy(1, 10);
+  std::vector<Event> events;
+  ASSERT_NO_THROW(events = buy(2, 10 + (1 << 20)));
+  constexpr auto isLadder = std::is_same_v<TypeParam, LadderPolicy> ||
+                            std::is_same_v<TypeParam, PooledLadderPolicy>;
+  EXPECT_EQ(events.back() == Event::Reject(1, 2, Event::RejectReason::PRICE_RANGE), isLadder);
+  // The ladder did not grow, and takes the next order.
+  EXPECT_EQ(buy(3, 11).back(), (isLadder) ? Event::TopOfBook('B', 11, 100) : Event::Ack(1, 3));
+  if (isLadder) {
+    EXPECT_EQ(orderBooks.GetMemoryStats().books[0].buyLevels.elements, 2u);
+  }
+}
+
+TEST(OrderBook, BookLimits) {
+  OrderBooks orderBooks;
+  orderBooks.SetBookLimits({.maxRestingOrders = 3, .maxLevels = 2});
+  UserOrderId_type userOrderId = 0;
+  auto add = [&](Order::OrderType orderType, Price_type price, Quantity_type quantity) {
+    const UserId_type userId = (orderType == Order::OrderType::BUY) ? 1 : 2;
+    return *orderBooks.HandleOrder(MakeOrder(orderType, userId, ++userOrderId, price, quantity));
+  };
+  const auto bookFull = [](UserOrderId_type userOrderId) {
+    return Event::Reject(1, userOrderId, Event::RejectReason::BOOK_FULL);
+  };
+  add(Order::OrderType::BUY, 10, 100);
+  add(Order::OrderType::BUY, 11, 100);
+  EXPECT_EQ(add(Order::OrderType::BUY, 12, 100).back(), bookFull(3));  // A third level.
+  EXPECT_NE(add(Order::OrderType::BUY, 11, 100).back().eventType, Event::EventType::REJECT);
+  EXPECT_EQ(add(Order::OrderType::BUY, 11, 100).back(), bookFull(5));  // A fourth order.
+  // Trading still works, and makes room.
+  const auto events = add(Order::OrderType::SELL, 11, 250);
+  EXPECT_EQ(events.back(), Event::TopOfBook('S', 11, 50));
+  EXPECT_NE(add(Order::OrderType::BUY, 9, 100).back().eventType, Event::EventType::REJECT);
+
+  const auto stats = orderBooks.GetMemoryStats();
+  ASSERT_EQ(stats.books.size(), 1u);
+  EXPECT_EQ(stats.books[0].rejectedOrders, 2u);
+  EXPECT_EQ(stats.books[0].orders.highWaterElements, 3u);
+  EXPECT_EQ(stats.books[0].buyLevels.highWaterElements, 2u);
+  EXPECT_GT(stats.Bytes(), 0u);
+
+  // A ladder has a level for every tick between its ends, a far price would add all of them.
+  OrderBooks ladderBooks;
+  ladderBooks.SetSymbolPolicy<LadderPolicy>("IBM");
+  ladderBooks.SetBookLimits({.maxRestingOrders = 10, .maxLevels = 100});
+  auto addToLadder = [&](Price_type price) -> std::optional<Event::RejectReason> {
+    const auto event =
+        ladderBooks.HandleOrder(MakeOrder(Order::OrderType::BUY, 1, ++userOrderId, price))->back();
+    if (event.eventType != Event::EventType::REJECT) {
+      return std::nullopt;
+    }
+    return event.reason;
+  };
+  EXPECT_EQ(addToLadder(10), std::nullopt);
+  EXPECT_EQ(addToLadder(1'000), Event::RejectReason::BOOK_FULL);
+  EXPECT_EQ(addToLadder(109), std::nullopt);  // 100 ticks.
+  EXPECT_EQ(addToLadder(110), Event::RejectReason::BOOK_FULL);
+  EXPECT_EQ(addToLadder(50), std::nullopt);
+  EXPECT_EQ(ladderBooks.GetMemoryStats().books[0].buyLevels.highWaterElements, 100u);
+}
+
+TEST(OrderBook, MixedPolicies) {
+  for (const auto& [id, scenario] : scenarios) {
+    OrderBooks orderBooks;
+    std::set<Symbol_type> symbols;
+    std::vector<std::string> log;
+    for (const auto& order : scenario.orders) {
+      // Alternate between the ladder and the flat levels, one symbol at a time.
+      if (!order.symbol.empty() && symbols.insert(order.symbol).second) {
+        if (symbols.size() % 2 == 1) {
+          orderBooks.SetSymbolPolicy<LadderPolicy>(order.symbol);
+        } else {
+          orderBooks.SetSymbolPolicy<FlatPolicy>(order.symbol);
+        }
+      }
+      if (const auto events = orderBooks.HandleOrder(order)) {
+        for (const auto& event : *events) {
+          log.push_back(to_string(event));
+        }
+      }
+    }
+    EXPECT_EQ(log, expectedOutputs.at(id)) << "Scenario " << id;
+  }
+}
+
+TEST(TradeAnalytics, MatchesTrades) {
+  OrderBooks orderBooks;
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{}, 4, 0, 1);
+  std::map<Symbol_type, std::vector<Event>> trades;
+  for (std::size_t i = 0; i < 20'000; ++i) {
+    auto order        = orderFlow.Next();
+    const auto symbol = order.symbol;
+    const auto events = orderBooks.HandleOrder(std::move(order));
+    for (const auto& event : *events) {
+      if (event.eventType == Event::EventType::TRADE) {
+        trades[symbol].push_back(event);
+      }
+    }
+  }
+  const auto snapshot        = orderBooks.GetTradeAnalytics().Snapshot();
+  std::int64_t totalNotional = 0;
+  ASSERT_EQ(snapshot.symbols.size(), trades.size());
+  for (const auto& [symbol, events] : trades) {
+    const auto i = snapshot.Find(symbol);
+    ASSERT_TRUE(i.has_value()) << symbol;
+    std::int64_t volume = 0, notional = 0, high = events[0].price, low = events[0].price;
+    for (const auto& event : events) {
+      volume   += event.quantity;
+      notional += static_cast<std::int64_t>(event.price) * event.quantity;
+      high      = std::max<std::int64_t>(high, event.price);
+      low       = std::min<std::int64_t>(low, event.price);
+    }
+    totalNotional += notional;
+    EXPECT_EQ(snapshot.volume[*i], volume) << symbol;
+    EXPECT_EQ(snapshot.notional[*i], notional) << symbol;
+    EXPECT_EQ(snapshot.trades[*i], static_cast<std::int64_t>(events.size())) << symbol;
+    EXPECT_EQ(snapshot.high[*i], high) << symbol;
+    EXPECT_EQ(snapshot.low[*i], low) << symbol;
+    EXPECT_EQ(snapshot.last[*i], events.back().price) << symbol;
+
+    std::int64_t barVolume = 0;
+    for (const auto& bar : orderBooks.GetTradeAnalytics().Bars(symbol)) {
+      EXPECT_LE(bar.low, bar.high) << symbol;
+      barVolume += bar.volume;
+    }
+    EXPECT_EQ(barVolume, volume) << symbol;
+  }
+  EXPECT_EQ(snapshot.TotalNotional(), totalNotional);
+
+  Order flush;
+  flush.orderType = Order::OrderType::FLUSH;
+  orderBooks.HandleOrder(flush);
+  EXPECT_EQ(orderBooks.GetTradeAnalytics().Snapshot().TotalVolume(), 0);
+}
+
+// Every trade is 10 lots at 100, so a torn read would show as notional != 100 * volume.
+TEST(TradeAnalytics, ReadsAreConsistent) {
+  TradeAnalytics analytics;
+  const std::vector<Event> events(3, Event::Trade(1, 1, 2, 2, 100, 10));
+  std::atomic<bool> done = false;
+  std::jthread writer([&] {
+    for (int i = 0; i < 200'000; ++i) {
+      analytics.Record(Symbol_type("IBM"), events);
+    }
+    done = true;
+  });
+  while (!done) {
+    const auto snapshot = analytics.Snapshot();
+    if (const auto i = snapshot.Find("IBM")) {
+      ASSERT_EQ(snapshot.notional[*i], 100 * snapshot.volume[*i]);
+      ASSERT_EQ(snapshot.volume[*i], 10 * snapshot.trades[*i]);
+      ASSERT_EQ(snapshot.trades[*i] % 3, 0);
+    }
+  }
+  writer.join();
+  EXPECT_EQ(analytics.Snapshot().TotalVolume(), 200'000 * 30);
+}
+
+// Plays the primary's side of the replication protocol by hand, so messages can be dropped.
+struct FakePrimary {
+  explicit FakePrimary(const std::string& port) {
+    SetAddrInfo(&addrInfo, "::1", port.c_str());
+    SetSocket(addrInfo, fd, 1);
+  }
+
+  ~FakePrimary() {
+    freeaddrinfo(addrInfo);
+    close(fd);
+  }
+
+  void Send(ReplicationMessage message) {
+    if (message.messageType == ReplicationMessage::MessageType::ORDERS) {
+      message.lastSequence = message.firstSequence + message.orders.size() - 1;
+    }
+    SerializeAndSend(message, fd, addrInfo->ai_addr, addrInfo->ai_addrlen);
+  }
+
+  void SendOrders(std::uint64_t first, std::uint64_t last) {
+    ReplicationMessage message{.messageType   = ReplicationMessage::MessageType::ORDERS,
+                               .firstSequence = first,
+                               .lastSequence  = 0,
+                               .orders        = {},
+                               .snapshotBytes = 0,
+                               .snapshot      = {}};
+    for (auto sequence = first; sequence <= last; ++sequence) {
+      message.orders.push_back(
+          MakeOrder(Order::OrderType::BUY, 1, static_cast<UserOrderId_type>(sequence)));
+    }
+    Send(message);
+  }
+
+  ReplicationMessage Receive() {
+    std::array<char, REPLICATION_DATAGRAM_SIZE> buffer;
+    const auto readStatus = recv(fd, buffer.data(), buffer.size(), 0);
+    if (readStatus < 0) {
+      throw std::runtime_error("FakePrimary got no request.");
+    }
+    ReplicationMessage message;
+    DeserializeObject(message, buffer.data(), readStatus);
+    return message;
+  }
+
+  addrinfo* addrInfo = nullptr;
+  int fd             = -1;
+};
+
+// The standby's end, to see what a real primary sends and to ask it for resends.
+struct FakeStandby {
+  explicit FakeStandby(const std::string& port) {
+    SetAddrInfo(&addrInfo, nullptr, port.c_str());
+    SetSocket(addrInfo, fd, 1);
+    BindSocket(addrInfo, fd);
+  }
+
+  ~FakeStandby() {
+    freeaddrinfo(addrInfo);
+    close(fd);
+  }
+
+  // The next message of that type, anything else (heartbeats) is skipped.
+  ReplicationMessage Receive(ReplicationMessage::MessageType messageType) {
+    std::array<char, REPLICATION_DATAGRAM_SIZE> buffer;
+    while (true) {
+      primaryLen            = sizeof(primary);
+      const auto readStatus = recvfrom(fd, buffer.data(), buffer.size(), 0,
+                                       reinterpret_cast<sockaddr*>(&primary), &primaryLen);
+      if (readStatus < 0) {
+        throw std::runtime_error("FakeStandby got nothing from the primary.");
+      }
+      ReplicationMessage message;
+      DeserializeObject(message, buffer.data(), readStatus);
+      if (message.messageType == messageType) {
+        return message;
+      }
+    }
+  }
+
+  void RequestResend(std::uint64_t first, std::uint64_t last) {
+    SerializeAndSend(ReplicationMessage{.messageType   = ReplicationMessage::MessageType::RESEND,
+                                        .firstSequence = first,
+                                        .lastSequence  = last,
+                                        .orders        = {},
+                                        .snapshotBytes = 0,
+                                        .snapshot      = {}},
+                     fd, reinterpret_cast<const sockaddr*>(&primary), primaryLen);
+  }
+
+  addrinfo* addrInfo = nullptr;
+  int fd             = -1;
+  sockaddr_storage primary{};
+  socklen_t primaryLen = sizeof(primary);
+};
+
+std::vector<UserOrderId_type> PollIds(StandbyManager& standby, std::size_t count) {
+  std::vector<UserOrderId_type> ids;
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (ids.size() < count && std::chrono::steady_clock::now() < deadline) {
+    standby.Poll([&](Order&& order) { ids.push_back(order.userOrderId); });
+  }
+  return ids;
+}
+
+TEST(Replication, GapsAreRequestedAgain) {
+  StandbyManager standby("18891");
+  FakePrimary primary("18891");
+
+  primary.SendOrders(1, 3);
+  primary.SendOrders(5, 6);  // 4 is lost.
+  const auto request = primary.Receive();
+  EXPECT_EQ(request.messageType, ReplicationMessage::MessageType::RESEND);
+  EXPECT_EQ(request.firstSequence, 4);
+  EXPECT_EQ(request.lastSequence, 4);
+  primary.SendOrders(4, 4);
+  EXPECT_EQ(PollIds(standby, 6), (std::vector<UserOrderId_type>{1, 2, 3, 4, 5, 6}));
+
+  // The tail is lost, only the heartbeat shows it.
+  primary.Send({.messageType   = ReplicationMessage::MessageType::HEARTBEAT,
+                .firstSequence = 0,
+                .lastSequence  = 8,
+                .orders        = {},
+                .snapshotBytes = 0,
+                .snapshot      = {}});
+  const auto tailRequest = primary.Receive();
+  EXPECT_EQ(tailRequest.firstSequence, 7);
+  EXPECT_EQ(tailRequest.lastSequence, 8);
+  primary.SendOrders(5, 8);  // Duplicates are ignored.
+  EXPECT_EQ(PollIds(standby, 2), (std::vector<UserOrderId_type>{7, 8}));
+  EXPECT_EQ(standby.GetStats().duplicateOrders, 2);
+}
+
+TEST(Replication, FlushSkipsGaps) {
+  StandbyManager standby("18892");
+  FakePrimary primary("18892");
+
+  primary.SendOrders(1, 2);
+  ReplicationMessage message{.messageType   = ReplicationMessage::MessageType::ORDERS,
+                             .firstSequence = 5,
+                             .lastSequence  = 0,
+                             .orders        = {},
+                             .snapshotBytes = 0,
+                             .snapshot      = {}};
+  Order flush;
+  flush.orderType = Order::OrderType::FLUSH;
+  message.orders.push_back(flush);
+  primary.Send(message);  // 3 and 4 are lost, but the books are reset at 5 anyway.
+  primary.SendOrders(6, 6);
+  EXPECT_EQ(PollIds(standby, 4), (std::vector<UserOrderId_type>{1, 2, -1, 6}));
+  EXPECT_EQ(standby.GetStats().skippedOrders, 2);
+}
+
+TEST(Replication, TooOldWaitsForFlush) {
+  StandbyManager standby("18895");
+  FakePrimary primary("18895");
+
+  primary.SendOrders(1, 2);
+  primary.SendOrders(5, 6);  // 3 and 4 are lost, and the primary no longer has them.
+  EXPECT_EQ(primary.Receive().messageType, ReplicationMessage::MessageType::RESEND);
+  primary.Send({.messageType   = ReplicationMessage::MessageType::TOO_OLD,
+                .firstSequence = 5,
+                .lastSequence  = 6,
+                .orders        = {},
+                .snapshotBytes = 0,
+                .snapshot      = {}});
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (standby.InSync() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  EXPECT_FALSE(standby.InSync());
+
+  // 5 and 6 can't be applied without 3 and 4, the FLUSH at 7 puts the books back in step.
+  ReplicationMessage message{.messageType   = ReplicationMessage::MessageType::ORDERS,
+                             .firstSequence = 7,
+                             .lastSequence  = 7,
+                             .orders        = {},
+                             .snapshotBytes = 0,
+                             .snapshot      = {}};
+  Order flush;
+  flush.orderType = Order::OrderType::FLUSH;
+  message.orders.push_back(flush);
+  primary.Send(message);
+  primary.SendOrders(8, 8);
+  EXPECT_EQ(PollIds(standby, 4), (std::vector<UserOrderId_type>{1, 2, -1, 8}));
+  EXPECT_TRUE(standby.InSync());
+  EXPECT_EQ(standby.GetStats().lostOrders, 2);
+  EXPECT_EQ(standby.GetStats().skippedOrders, 2);
+}
+
+TEST(Replication, PrimaryLostAndStopped) {
+  StandbyManager standby("18893");
+  FakePrimary primary("18893");
+
+  EXPECT_FALSE(standby.PrimaryLost());  // Never heard of one.
+  primary.Send({.messageType   = ReplicationMessage::MessageType::HEARTBEAT,
+                .firstSequence = 0,
+                .lastSequence  = 0,
+                .orders        = {},
+                .snapshotBytes = 0,
+                .snapshot      = {}});
+  std::this_thread::sleep_for(std::chrono::milliseconds(REPLICATION_TAKEOVER_MS / 2));
+  EXPECT_FALSE(standby.PrimaryLost());
+  std::this_thread::sleep_for(std::chrono::milliseconds(REPLICATION_TAKEOVER_MS * 2));
+  EXPECT_TRUE(standby.PrimaryLost());
+
+  primary.Send({.messageType   = ReplicationMessage::MessageType::SHUTDOWN,
+                .firstSequence = 0,
+                .lastSequence  = 0,
+                .orders        = {},
+                .snapshotBytes = 0,
+                .snapshot      = {}});
+  std::this_thread::sleep_for(std::chrono::milliseconds(REPLICATION_TAKEOVER_MS / 2));
+  EXPECT_TRUE(standby.PrimaryStopped());
+}
+
+TEST(Replication, StandbyBooksMatchPrimary) {
+  StandbyManager standby("18894");
+  ReplicationManager replication("::1", "18894");
+
+  OrderFlowConfig config;
+  std::vector<OrderFlowGenerator> generators;
+  for (int userId = 1; userId <= 3; ++userId) {
+    generators.emplace_back(config, userId, userId, 3, userId);
+  }
+  OrderBooks primaryBooks;
+  OrderBooks standbyBooks;
+  std::vector<std::string> primaryLog;
+  std::vector<std::string> standbyLog;
+  static constexpr std::size_t numOrders = 20'000;
+  for (std::size_t i = 0; i < numOrders; ++i) {
+    const auto order = generators[i % generators.size()].Next();
+    replication.Push(order);
+    const auto events = primaryBooks.HandleOrder(order);
+    for (const auto& event : *events) {
+      primaryLog.push_back(to_string(event));
+    }
+  }
+
+  std::size_t applied = 0;
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (applied < numOrders && std::chrono::steady_clock::now() < deadline) {
+    applied += standby.Poll([&](Order&& order) {
+      const auto events = standbyBooks.HandleOrder(std::move(order));
+      for (const auto& event : *events) {
+        standbyLog.push_back(to_string(event));
+      }
+    });
+  }
+  EXPECT_EQ(applied, numOrders);
+  EXPECT_EQ(standbyLog, primaryLog);
+}
+
+TEST(Replication, ReachesIpv4Standby) {
+  StandbyManager standby("18897");
+  ReplicationManager replication("127.0.0.1", "18897");
+
+  replication.Push(MakeOrder(Order::OrderType::BUY, 1));
+
+  std::size_t applied = 0;
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (applied == 0 && std::chrono::steady_clock::now() < deadline) {
+    applied += standby.Poll([&](Order&& received) { EXPECT_EQ(received.userOrderId, 1); });
+  }
+  EXPECT_EQ(applied, 1);
+}
+
+TEST(Replication, ResendWindowIsBounded) {
+  FakeStandby standby("18896");
+  ReplicationManager replication("::1", "18896", 4);
+  for (UserOrderId_type id = 1; id <= 10; ++id) {
+    replication.Push(MakeOrder(Order::OrderType::BUY, 1, id));
+  }
+  while (standby.Receive(ReplicationMessage::MessageType::ORDERS).lastSequence < 10) {
+  }
+
+  // Only 7 to 10 are left. The primary says so, and sends those.
+  standby.RequestResend(2, 10);
+  const auto tooOld = standby.Receive(ReplicationMessage::MessageType::TOO_OLD);
+  EXPECT_EQ(tooOld.firstSequence, 7);
+  EXPECT_EQ(tooOld.lastSequence, 10);
+  const auto resend = standby.Receive(ReplicationMessage::MessageType::ORDERS);
+  EXPECT_EQ(resend.firstSequence, 7);
+  ASSERT_EQ(resend.orders.size(), 4u);
+  EXPECT_EQ(resend.orders.front().userOrderId, 7);
+  const auto memory = replication.GetLogMemory();
+  EXPECT_EQ(memory.elements, 4u);
+  EXPECT_EQ(memory.highWaterElements, 4u);
+  EXPECT_GT(memory.bytes, 0u);
+
+  // Nothing before a FLUSH is needed, so asking for it is not too old.
+  replication.Push(MakeOrder(Order::OrderType::FLUSH, 1, -1));
+  while (standby.Receive(ReplicationMessage::MessageType::ORDERS).lastSequence < 11) {
+  }
+  standby.RequestResend(2, 11);
+  EXPECT_EQ(standby.Receive(ReplicationMessage::MessageType::ORDERS).firstSequence, 11);
+  EXPECT_EQ(replication.GetStats().tooOldRequests, 1);
+}
+
+// One round of both matching threads. The primary's takes a snapshot if one is wanted, the
+// standby's applies what has arrived, or loads a snapshot.
+template <typename Replication_T>
+void FollowPrimary(Replication_T& replication, OrderBooks& primaryBooks, StandbyManager& standby,
+                   OrderBooks& standbyBooks, std::vector<std::string>& standbyLog) {
+  if (replication.SnapshotWanted()) {
+    replication.PushSnapshot(SerializeObject(primaryBooks.Snapshot()));
+  }
+  standby.Poll([&](Order&& order) {
+    const auto events = standbyBooks.HandleOrder(std::move(order));
+    for (const auto& event : *events) {
+      standbyLog.push_back(to_string(event));
+    }
+  });
+  if (auto snapshot = standby.TakeSnapshot()) {
+    OrderBooksSnapshot books;
+    DeserializeObject(books, snapshot->data(), snapshot->size());
+    standbyBooks.LoadSnapshot(books);
+  }
+}
+
+// Started after the primary's resend window has moved on, the standby catches up from a snapshot of
+// its books instead.
+TEST(Replication, LateStandbyLoadsSnapshot) {
+  ReplicationManager replication("::1", "18898", 64);
+  OrderBooks primaryBooks;
+  OrderBooks standbyBooks;
+  // Few cancels, so that the books grow past what one snapshot request brings in.
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{.symbols = {"AAPL", "IBM"}, .cancelWeight = 0.05},
+                                 4, 0, 2);
+  std::vector<std::string> primaryLog;
+  auto push = [&](std::size_t count, bool log) {
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto order = orderFlow.Next();
+      replication.Push(order);
+      const auto events = primaryBooks.HandleOrder(order);
+      for (const auto& event : *events) {
+        if (log) {
+          primaryLog.push_back(to_string(event));
+        }
+      }
+    }
+  };
+  push(20'000, false);
+
+  StandbyManager standby("18898");
+  std::vector<std::string> standbyLog;
+  auto follow = [&] {
+    FollowPrimary(replication, primaryBooks, standby, standbyBooks, standbyLog);
+  };
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while ((standby.GetStats().snapshots == 0 || !standby.InSync()) &&
+         std::chrono::steady_clock::now() < deadline) {
+    follow();
+  }
+  ASSERT_TRUE(standby.InSync());
+  EXPECT_EQ(standby.GetStats().snapshots, 1);
+  EXPECT_EQ(standby.GetStats().lastSequence, 20'000);
+  EXPECT_GE(replication.GetStats().snapshots, 1);
+
+  // From here on both books trade the same.
+  standbyLog.clear();
+  push(20'000, true);
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (standby.GetStats().appliedOrders < 20'000 && std::chrono::steady_clock::now() < deadline) {
+    follow();
+  }
+  follow();
+  EXPECT_EQ(standbyLog, primaryLog);
+}
+
+// A matching thread that outruns replication drops orders rather than wait for it, and the standby
+// catches up from a snapshot.
+TEST(Replication, FullQueueDropsOrders) {
+  StandbyManager standby("18899");
+  BasicReplicationManager<16> replication("::1", "18899");
+  OrderBooks primaryBooks;
+  OrderBooks standbyBooks;
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{.symbols = {"AAPL", "IBM"}}, 4, 0, 3);
+  std::vector<std::string> standbyLog;
+  auto follow = [&] {
+    FollowPrimary(replication, primaryBooks, standby, standbyBooks, standbyLog);
+  };
+  static constexpr std::size_t numOrders = 20'000;
+  for (std::size_t i = 0; i < numOrders; ++i) {
+    const auto order = orderFlow.Next();
+    replication.Push(order);
+    primaryBooks.HandleOrder(order);
+    if (i % 256 == 255) {
+      follow();  // End of a batch.
+    }
+  }
+  const auto dropped = replication.GetStats().droppedOrders;
+  EXPECT_GT(dropped, 0);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!(standby.InSync() && standby.GetStats().lastSequence == numOrders) &&
+         std::chrono::steady_clock::now() < deadline) {
+    follow();
+  }
+  ASSERT_TRUE(standby.InSync());
+  EXPECT_EQ(standby.GetStats().lastSequence, numOrders);
+  EXPECT_GE(standby.GetStats().snapshots, 1);
+
+  // From here on both books trade the same. One order at a time, so that none is dropped.
+  follow();
+  standbyLog.clear();
+  std::vector<std::string> primaryLog;
+  for (std::size_t i = 1; i <= 1'000; ++i) {
+    const auto order = orderFlow.Next();
+    replication.Push(order);
+    const auto events = primaryBooks.HandleOrder(order);
+    for (const auto& event : *events) {
+      primaryLog.push_back(to_string(event));
+    }
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (standby.GetStats().lastSequence < numOrders + i &&
+           std::chrono::steady_clock::now() < deadline) {
+    }
+    follow();
+  }
+  EXPECT_EQ(standbyLog, primaryLog);
+  EXPECT_EQ(replication.GetStats().droppedOrders, dropped);
+}
+
+// CPU time of the calling thread.
+std::chrono::nanoseconds ThreadCpuTime() {
+  timespec time{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+
+TEST(IdleBackoff, SleepsOnceIdle) {
+  IdleBackoff backoff;
+  const auto start = IdleBackoff::Clock::now();
+  while (IdleBackoff::Clock::now() - start < std::chrono::microseconds(IDLE_SPIN_MICROS)) {
+    backoff.Wait();
+  }
+  // Past the spin, a wait sleeps instead of burning the core.
+  const auto cpuStart  = ThreadCpuTime();
+  const auto wallStart = IdleBackoff::Clock::now();
+  for (int i = 0; i < 50; ++i) {
+    backoff.Wait();
+  }
+  const auto wall = IdleBackoff::Clock::now() - wallStart;
+  EXPECT_GE(wall, 50 * std::chrono::microseconds(IDLE_SLEEP_MICROS));
+  EXPECT_LT(ThreadCpuTime() - cpuStart, wall / 4);
+
+  // Work puts it back to spinning.
+  backoff.Reset();
+  const auto spinStart = IdleBackoff::Clock::now();
+  backoff.Wait();
+  EXPECT_LT(IdleBackoff::Clock::now() - spinStart, std::chrono::microseconds(IDLE_SLEEP_MICROS));
+}
+
+TEST(AdmissionControl, RateLimitsEachUser) {
+  AdmissionControl admission;
+  const auto now     = AdmissionControl::Clock::now();
+  const auto buy     = MakeOrder(Order::OrderType::BUY, 1);
+  std::uint32_t slot = AdmissionControl::noSlot;
+  for (std::int64_t i = 0; i < USER_ORDER_BURST; ++i) {
+    ASSERT_FALSE(admission.Admit(buy, now, false, slot).has_value());
+    admission.Release(slot);
+  }
+  EXPECT_EQ(admission.Admit(buy, now, false, slot), Event::RejectReason::RATE_LIMIT);
+  EXPECT_EQ(admission.Admit(MakeOrder(Order::OrderType::CANCEL, 1), now, false, slot),
+            Event::RejectReason::RATE_LIMIT);
+  // Other users have buckets of their own.
+  EXPECT_FALSE(admission.Admit(MakeOrder(Order::OrderType::BUY, 2), now, false, slot).has_value());
+  // One token comes back every 1 / USER_ORDER_RATE seconds.
+  const auto later = now + std::chrono::nanoseconds(std::nano::den / USER_ORDER_RATE);
+  EXPECT_FALSE(admission.Admit(buy, later, false, slot).has_value());
+  EXPECT_EQ(admission.Admit(buy, later, false, slot), Event::RejectReason::RATE_LIMIT);
+}
+
+TEST(AdmissionControl, CapsOrdersInFlightPerSymbol) {
+  AdmissionControl admission;
+  const auto now = AdmissionControl::Clock::now();
+  std::vector<std::uint32_t> slots(SYMBOL_MAX_IN_FLIGHT);
+  for (std::uint32_t i = 0; i < SYMBOL_MAX_IN_FLIGHT; ++i) {
+    const auto order = MakeOrder(Order::OrderType::SELL, static_cast<UserId_type>(i));
+    ASSERT_FALSE(admission.Admit(order, now, false, slots[i]).has_value());
+  }
+  std::uint32_t slot = AdmissionControl::noSlot;
+  EXPECT_EQ(admission.Admit(MakeOrder(Order::OrderType::BUY, -5), now, false, slot),
+            Event::RejectReason::SYMBOL_IN_FLIGHT);
+  // Cancels aren't counted against the symbol.
+  EXPECT_FALSE(
+      admission.Admit(MakeOrder(Order::OrderType::CANCEL, -5), now, false, slot).has_value());
+  admission.Release(slots[0]);
+  EXPECT_FALSE(admission.Admit(MakeOrder(Order::OrderType::BUY, -5), now, false, slot).has_value());
+}
+
+TEST(AdmissionControl, ShedsNewOrdersBeforeCancels) {
+  AdmissionControl admission;
+  const auto now     = AdmissionControl::Clock::now();
+  std::uint32_t slot = AdmissionControl::noSlot;
+  EXPECT_EQ(admission.Admit(MakeOrder(Order::OrderType::BUY, 1), now, true, slot),
+            Event::RejectReason::OVERLOAD);
+  EXPECT_EQ(admission.Admit(MakeOrder(Order::OrderType::SELL, 1), now, true, slot),
+            Event::RejectReason::OVERLOAD);
+  EXPECT_FALSE(
+      admission.Admit(MakeOrder(Order::OrderType::CANCEL, 1), now, true, slot).has_value());
+  EXPECT_FALSE(
+      admission.Admit(MakeOrder(Order::OrderType::FLUSH, 1), now, true, slot).has_value());
+}
+
+std::vector<CapturedOrder> ReadCapture(const std::string& fileName) {
+  CaptureReader reader(fileName);
+  std::vector<CapturedOrder> captured;
+  for (std::vector<CapturedOrder> block; reader.Next(block);) {
+    captured.insert(captured.end(), block.begin(), block.end());
+  }
+  return captured;
+}
+
+TEST(Capture, RoundTrip) {
+  const auto fileName = std::filesystem::temp_directory_path() / "orderbook_test.obc";
+  InterleavedOrderFlow orderFlow(OrderFlowConfig{}, 4, 1e-3, 1);
+  std::vector<CapturedOrder> expected;
+  std::int64_t timestamp = 1'000'000;
+  for (std::size_t i = 0; i < CAPTURE_BLOCK_ORDERS * 5 / 2; ++i) {
+    timestamp += static_cast<std::int64_t>(i % 7) * 1'000 - 2'000;  // Not always increasing.
+    expected.push_back({timestamp, orderFlow.Next()});
+  }
+  for (const auto compress : {false, true}) {
+    {
+      CaptureWriter writer(fileName, compress);
+      for (const auto& [timestamp, order] : expected) {
+        writer.Add(timestamp, order);
+      }
+    }
+    const auto captured = ReadCapture(fileName);
+    ASSERT_EQ(captured.size(), expected.size());
+    for (std::size_t i = 0; i < captured.size(); ++i) {
+      EXPECT_EQ(captured[i].timestamp, expected[i].timestamp) << i;
+      EXPECT_EQ(to_string(captured[i].order), to_string(expected[i].order)) << i;
+    }
+  }
+  std::filesystem::remove(fileName);
+}
+
+TEST(Capture, RejectsTruncatedCapture) {
+  const auto fileName = std::filesystem::temp_directory_path() / "orderbook_truncated.obc";
+  {
+    CaptureWriter writer(fileName, true);
+    for (std::int64_t i = 0; i < 100; ++i) {
+      writer.Add(i, MakeOrder(Order::OrderType::BUY, 1));
+    }
+  }
+  std::filesystem::resize_file(fileName, std::filesystem::file_size(fileName) - 1);
+  EXPECT_THROW(ReadCapture(fileName), std::runtime_error);
+  std::filesystem::remove(fileName);
+}
+
+TEST(Capture, RejectsCorruptBlockHeader) {
+  const auto fileName = std::filesystem::temp_directory_path() / "orderbook_corrupt.obc";
+  // Writes a one block capture, changes its block header with edit and cuts cutBytes off the end.
+  auto corrupt = [&](bool compress, auto&& edit, std::uintmax_t cutBytes = 0) {
+    {
+      CaptureWriter writer(fileName, compress);
+      for (std::int64_t i = 0; i < 100; ++i) {
+        writer.Add(i, MakeOrder(Order::OrderType::BUY, 1));
+      }
+    }
+    std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+    CaptureBlockHeader header;
+    file.seekg(sizeof(CaptureHeader));
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    edit(header);
+    file.seekp(sizeof(CaptureHeader));
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    std::filesystem::resize_file(fileName, std::filesystem::file_size(fileName) - cutBytes);
+  };
+
+  // The block's last byte is cut off and its stored size shrunk to match. Decoding rawBytes would
+  // read past the end of the file.
+  corrupt(false, [](CaptureBlockHeader& header) { --header.storedBytes; }, 1);
+  EXPECT_THROW(ReadCapture(fileName), std::runtime_error);
+
+  // Sizes that would be allocated before anything shows they are wrong.
+  for (const auto numOrders : {std::uint32_t{CAPTURE_BLOCK_ORDERS + 1}, std::uint32_t{2000},
+                               std::numeric_limits<std::uint32_t>::max()}) {
+    corrupt(false, [&](CaptureBlockHeader& header) { header.numOrders = numOrders; });
+    EXPECT_THROW(ReadCapture(fileName), std::runtime_error) << numOrders;
+  }
+  corrupt(true, [](CaptureBlockHeader& header) {
+    header.rawBytes = std::numeric_limits<std::uint32_t>::max();
+  });
+  EXPECT_THROW(ReadCapture(fileName), std::runtime_error);
+  std::filesystem::remove(fileName);
+}
+
+TEST(Capture, StopsOnWriteFailure) {
+  {
+    // Every write to /dev/full fails, the unwritten block is dropped without throwing.
+    CaptureWriter writer("/dev/full", false);
+    writer.Add(0, MakeOrder(Order::OrderType::BUY, 1));
+  }
+
+  CaptureManager capture("/dev/full", false);
+  static constexpr std::size_t numOrders = 3 * CAPTURE_BLOCK_ORDERS;
+  for (std::size_t i = 0; i < numOrders; ++i) {
+    capture.Push(CaptureManager::Clock::now(), MakeOrder(Order::OrderType::BUY, 1));
+  }
+  capture.Stop();
+  const auto stats = capture.GetStats();
+  EXPECT_EQ(stats.writeFailures, 1);
+  EXPECT_EQ(stats.capturedOrders, 0);
+  EXPECT_EQ(stats.droppedOrders, numOrders);
+}
+
+std::vector<std::string> ReadLines(const std::filesystem::path& fileName) {
+  std::ifstream file(fileName);
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(file, line);) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+// Past half of its cap the log is written ahead of the FLUSH, into the round's file, so the cap
+// only turns orders away while writing is behind. Cancels and FLUSHes always get in.
+TEST(LogManager, WritesAheadOfFlush) {
+  const auto directory = std::filesystem::temp_directory_path() / "orderbook_test_logs";
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directory(directory);
+  {
+    LogManager full(directory, 0, false);
+    EXPECT_FALSE(full.Admits(MakeOrder(Order::OrderType::BUY, 1)));
+    EXPECT_TRUE(full.Admits(MakeOrder(Order::OrderType::CANCEL, 1)));
+    EXPECT_TRUE(full.Admits(MakeOrder(Order::OrderType::FLUSH, 1)));
+  }
+
+  LogManager log(directory, 8, false);
+  std::vector<std::string> expected;
+  auto add = [&](UserOrderId_type first, UserOrderId_type last) {
+    std::vector<Event> events;
+    for (auto id = first; id <= last; ++id) {
+      events.push_back(Event::Ack(1, id));
+      expected.push_back(to_string(events.back()));
+    }
+    log.Add(events);
+  };
+  add(1, 3);
+  add(4, 5);  // Half of the cap, written out without a FLUSH.
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (ReadLines(directory / "1.log").size() < 5 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(ReadLines(directory / "1.log"), expected);
+  EXPECT_EQ(log.GetStats().writtenChunks, 1);
+  EXPECT_TRUE(log.Admits(MakeOrder(Order::OrderType::BUY, 1)));
+
+  add(6, 6);
+  log.Flush();  // The rest of the round goes to the same file.
+  EXPECT_EQ(ReadLines(directory / "1.log"), expected);
+  expected.clear();
+  add(7, 7);
+  log.Flush();
+  EXPECT_EQ(ReadLines(directory / "2.log"), expected);
+  log.Flush();  // Nothing in the round, no file.
+  EXPECT_FALSE(std::filesystem::exists(directory / "3.log"));
+  EXPECT_EQ(log.GetStats().queuedEventsHighWater, 5);
+  std::filesystem::remove_all(directory);
+}